@@ -0,0 +1,332 @@
+// In-memory account balances and trustlines, for the crossing limits that
+// stellar-core reads from the ledger
+
+#include "AccountStore.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace stellar
+{
+
+AccountStore::AccountStore(BookRegistry const& registry, int64_t baseReserve)
+    : mRegistry(registry), mBaseReserve(baseReserve)
+{
+    releaseAssertOrThrow(baseReserve >= 0);
+}
+
+void
+AccountStore::reserve(size_t entries)
+{
+    mEntries.reserve(entries);
+    mAccounts.reserve(entries);
+    mLines.reserve(entries);
+}
+
+BalanceEntry&
+AccountStore::createAccount(AccountID account, int64_t balance)
+{
+    releaseAssertOrThrow(account != 0);
+    releaseAssertOrThrow(balance >= 0);
+    if (!mAccounts.insert(account, (uint32_t)mEntries.size()))
+    {
+        throw std::runtime_error("account already exists");
+    }
+    BalanceEntry entry{};
+    entry.account = account;
+    entry.balance = balance;
+    entry.limit = INT64_MAX;
+    mEntries.push_back(entry);
+    return mEntries.back();
+}
+
+BalanceEntry&
+AccountStore::createTrustLine(AccountID account, AssetID asset, int64_t limit,
+                              uint32_t flags)
+{
+    releaseAssertOrThrow(limit > 0);
+    if (isNative(asset) || isIssuer(account, asset))
+    {
+        throw std::runtime_error("trustline not allowed");
+    }
+    uint32_t const* accountIndex = mAccounts.find(account);
+    if (!accountIndex)
+    {
+        throw std::runtime_error("no such account");
+    }
+    uint32_t owner = *accountIndex;
+    if (!mLines.insert(lineKey(owner, asset), (uint32_t)mEntries.size()))
+    {
+        throw std::runtime_error("trustline already exists");
+    }
+    ++mEntries[owner].numSubEntries;
+    BalanceEntry entry{};
+    entry.account = account;
+    entry.asset = asset;
+    entry.flags = flags;
+    entry.limit = limit;
+    mEntries.push_back(entry);
+    return mEntries.back();
+}
+
+BalanceEntry*
+AccountStore::findAccount(AccountID account)
+{
+    auto index = mAccounts.find(account);
+    return index ? &mEntries[*index] : nullptr;
+}
+
+BalanceEntry const*
+AccountStore::findAccount(AccountID account) const
+{
+    auto index = mAccounts.find(account);
+    return index ? &mEntries[*index] : nullptr;
+}
+
+BalanceEntry*
+AccountStore::findTrustLine(AccountID account, AssetID asset)
+{
+    auto index = mAccounts.find(account);
+    if (!index)
+    {
+        return nullptr;
+    }
+    auto line = mLines.find(lineKey(*index, asset));
+    return line ? &mEntries[*line] : nullptr;
+}
+
+BalanceEntry const*
+AccountStore::findTrustLine(AccountID account, AssetID asset) const
+{
+    auto index = mAccounts.find(account);
+    if (!index)
+    {
+        return nullptr;
+    }
+    auto line = mLines.find(lineKey(*index, asset));
+    return line ? &mEntries[*line] : nullptr;
+}
+
+int64_t
+AccountStore::minBalance(BalanceEntry const& account) const
+{
+    int64_t entries = 2 + (int64_t)account.numSubEntries +
+                      account.numSponsoring - account.numSponsored;
+    return entries * mBaseReserve;
+}
+
+BalanceEntry*
+AccountStore::liabilityEntry(AccountID account, AssetID asset)
+{
+    if (isNative(asset))
+    {
+        return findAccount(account);
+    }
+    return isIssuer(account, asset) ? nullptr : findTrustLine(account, asset);
+}
+
+BalanceEntry const*
+AccountStore::liabilityEntry(AccountID account, AssetID asset) const
+{
+    if (isNative(asset))
+    {
+        return findAccount(account);
+    }
+    return isIssuer(account, asset) ? nullptr : findTrustLine(account, asset);
+}
+
+// What an offer of amount at price commits: wheat it may sell and sheep it
+// may buy, as getOfferSellingLiabilities and getOfferBuyingLiabilities.
+static ExchangeResultV10
+offerLiabilities(Price const& price, int64_t amount)
+{
+    if (amount == 0)
+    {
+        return ExchangeResultV10{0, 0, false};
+    }
+    return exchangeV10WithoutPriceErrorThresholds(
+        price, amount, INT64_MAX, INT64_MAX, INT64_MAX, RoundingType::NORMAL);
+}
+
+// Whether liabilities can move by delta and stay within [0, INT64_MAX].
+static bool
+canAddLiability(int64_t liabilities, int64_t delta)
+{
+    return delta > 0 ? liabilities <= INT64_MAX - delta
+                     : liabilities >= -delta;
+}
+
+static void
+addLiability(int64_t& liabilities, int64_t delta)
+{
+    releaseAssertOrThrow(canAddLiability(liabilities, delta));
+    liabilities += delta;
+}
+
+void
+AccountStore::checkOfferLiabilities(AccountID seller, AssetID selling,
+                                    AssetID buying, Price const& oldPrice,
+                                    int64_t oldAmount, Price const& newPrice,
+                                    int64_t newAmount) const
+{
+    auto before = offerLiabilities(oldPrice, oldAmount);
+    auto after = offerLiabilities(newPrice, newAmount);
+    auto sellingEntry = liabilityEntry(seller, selling);
+    auto buyingEntry = liabilityEntry(seller, buying);
+    if ((sellingEntry &&
+         !canAddLiability(sellingEntry->sellingLiabilities,
+                          after.numWheatReceived - before.numWheatReceived)) ||
+        (buyingEntry &&
+         !canAddLiability(buyingEntry->buyingLiabilities,
+                          after.numSheepSend - before.numSheepSend)))
+    {
+        throw std::overflow_error("overflow while updating liabilities");
+    }
+}
+
+void
+AccountStore::updateOfferLiabilities(AccountID seller, AssetID selling,
+                                     AssetID buying, Price const& price,
+                                     int64_t oldAmount, int64_t newAmount)
+{
+    if (oldAmount == newAmount)
+    {
+        return;
+    }
+    // Both sides are checked before either moves.
+    checkOfferLiabilities(seller, selling, buying, price, oldAmount, price,
+                          newAmount);
+    auto before = offerLiabilities(price, oldAmount);
+    auto after = offerLiabilities(price, newAmount);
+    if (auto entry = liabilityEntry(seller, selling))
+    {
+        addLiability(entry->sellingLiabilities,
+                     after.numWheatReceived - before.numWheatReceived);
+    }
+    if (auto entry = liabilityEntry(seller, buying))
+    {
+        addLiability(entry->buyingLiabilities,
+                     after.numSheepSend - before.numSheepSend);
+    }
+}
+
+void
+AccountStore::checkLiabilities() const
+{
+    std::vector<int64_t> buying(mEntries.size(), 0);
+    std::vector<int64_t> selling(mEntries.size(), 0);
+    mRegistry.forEachBook(
+        [&](AssetID wheat, AssetID sheep, OrderBook const& book) {
+            if (book.accountStore() != this)
+            {
+                return;
+            }
+            book.forEachOffer([&](Offer const& offer) {
+                auto committed = offerLiabilities(offer.price, offer.amount);
+                if (auto entry = liabilityEntry(offer.sellerID, wheat))
+                {
+                    addLiability(selling[entry - mEntries.data()],
+                                 committed.numWheatReceived);
+                }
+                if (auto entry = liabilityEntry(offer.sellerID, sheep))
+                {
+                    addLiability(buying[entry - mEntries.data()],
+                                 committed.numSheepSend);
+                }
+            });
+        });
+    for (size_t i = 0; i < mEntries.size(); ++i)
+    {
+        if (mEntries[i].buyingLiabilities != buying[i] ||
+            mEntries[i].sellingLiabilities != selling[i])
+        {
+            throw std::runtime_error("liabilities do not match offers");
+        }
+    }
+}
+
+static bool
+isAuthorizedToMaintainLiabilities(BalanceEntry const& line)
+{
+    return (line.flags &
+            (AUTHORIZED_FLAG | AUTHORIZED_TO_MAINTAIN_LIABILITIES_FLAG)) != 0;
+}
+
+// What the trustline (or the native balance) can still receive, as
+// getMaxAmountReceive; may be negative.
+static int64_t
+maxAmountReceive(BalanceEntry const& entry)
+{
+    if (entry.asset == 0)
+    {
+        return INT64_MAX - entry.balance - entry.buyingLiabilities;
+    }
+    if ((entry.flags & AUTHORIZED_FLAG) == 0)
+    {
+        return 0;
+    }
+    return entry.limit - entry.balance - entry.buyingLiabilities;
+}
+
+int64_t
+canSellAtMost(AccountStore const& store, AccountID account, AssetID asset)
+{
+    if (store.isNative(asset))
+    {
+        // can only send above the minimum balance
+        auto entry = store.findAccount(account);
+        if (!entry)
+        {
+            return 0;
+        }
+        return std::max({entry->balance - store.minBalance(*entry) -
+                             entry->sellingLiabilities,
+                         int64_t(0)});
+    }
+    if (store.isIssuer(account, asset))
+    {
+        return INT64_MAX;
+    }
+
+    auto line = store.findTrustLine(account, asset);
+    if (line && isAuthorizedToMaintainLiabilities(*line))
+    {
+        return std::max(
+            {line->balance - line->sellingLiabilities, int64_t(0)});
+    }
+    return 0;
+}
+
+int64_t
+canBuyAtMost(AccountStore const& store, AccountID account, AssetID asset)
+{
+    if (!store.isNative(asset) && store.isIssuer(account, asset))
+    {
+        return INT64_MAX;
+    }
+    auto entry = store.isNative(asset) ? store.findAccount(account)
+                                       : store.findTrustLine(account, asset);
+    return entry ? std::max({maxAmountReceive(*entry), int64_t(0)}) : 0;
+}
+
+int64_t
+canSellAtMostBasedOnSheep(AccountStore const& store, AccountID account,
+                          AssetID sheep, Price const& wheatPrice)
+{
+    if (store.isNative(sheep))
+    {
+        return INT64_MAX;
+    }
+
+    // compute value based on what the account can receive
+    int64_t sellerMaxSheep = canBuyAtMost(store, account, sheep);
+
+    int64_t wheatAmount;
+    if (!bigDivide128(wheatAmount, bigMultiply(sellerMaxSheep, wheatPrice.d),
+                      wheatPrice.n, ROUND_DOWN))
+    {
+        wheatAmount = INT64_MAX;
+    }
+    return wheatAmount;
+}
+}
@@ -0,0 +1,187 @@
+// In-memory account balances and trustlines, for the crossing limits that
+// stellar-core reads from the ledger
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "OfferExchange.h"
+#include "BookRegistry.h"
+#include "FlatHashMap.h"
+
+namespace stellar
+{
+
+// stellar's TrustLineFlags.
+enum TrustLineFlags
+{
+    AUTHORIZED_FLAG = 1,
+    AUTHORIZED_TO_MAINTAIN_LIABILITIES_FLAG = 2,
+    TRUSTLINE_CLAWBACK_ENABLED_FLAG = 4
+};
+
+// What an account holds of one asset: its native balance (asset 0) or one of
+// its trustlines. Liabilities are the amounts its open offers have committed,
+// as in stellar's Liabilities extension. Records are one cache line each, so
+// working out a limit touches a single line per side of a crossing.
+struct alignas(64) BalanceEntry
+{
+    AccountID account;
+    AssetID asset; // 0 for the native balance
+    uint32_t flags; // TrustLineFlags; unused for the native balance
+    int64_t balance;
+    int64_t limit; // INT64_MAX for the native balance
+    int64_t buyingLiabilities;
+    int64_t sellingLiabilities;
+    // Native balance only: the entries the base reserve is held for.
+    uint32_t numSubEntries;
+    uint32_t numSponsoring;
+    uint32_t numSponsored;
+};
+static_assert(sizeof(BalanceEntry) == 64,
+              "BalanceEntry must stay one cache line");
+
+// AccountStore holds the balance entries of the accounts that trade on the
+// in-memory books, in place of the LedgerTxn entries stellar-core loads for
+// every offer it crosses.
+//
+// Entries live in one array and a FlatHashMap64 finds them by (account,
+// asset). Accounts are numbered as they are created and the key is (number
+// << 32) | asset, so the native balance of an account is one probe and a
+// trustline two: one for the number, which is the account's own entry, and
+// one for the line. Lookups never allocate, and neither do the limits below.
+//
+// Liabilities are kept incrementally by the books the store is attached to
+// (OrderBook::setAccountStore, BookRegistry::setAccountStore): each change to
+// an offer's amount moves its seller's liabilities by the difference between
+// what the offer commits before and after, as stellar-core's
+// getOfferSellingLiabilities and getOfferBuyingLiabilities work it out. A fill
+// therefore costs O(1) however many offers the seller has. Issuers commit
+// nothing, as in stellar-core, and neither do sellers without the entry,
+// which stellar-core would not let place the offer; create entries before
+// the offers that need them.
+//
+// checkLiabilities recomputes everything from the offers in the attached
+// books and throws if that differs from what was kept, like stellar-core's
+// LiabilitiesMatchOffers invariant. It costs O(offers); in debug runs
+// setCheckLiabilities(true) makes every attached book call it after each
+// change.
+//
+// Entries are never removed. Pointers to them stay valid until the next
+// entry is created.
+class AccountStore
+{
+  public:
+    // baseReserve is stellar's base reserve in stroops (0.5 XLM by default).
+    explicit AccountStore(BookRegistry const& registry,
+                          int64_t baseReserve = 5000000);
+
+    // Creates an account holding balance of the native asset. Throws if it
+    // exists or account is 0.
+    BalanceEntry& createAccount(AccountID account, int64_t balance);
+
+    // Creates a trustline of an existing account, counting it as a
+    // subentry. Throws if it exists, the asset is native or unknown, or
+    // account is its issuer, which needs none.
+    BalanceEntry& createTrustLine(AccountID account, AssetID asset,
+                                  int64_t limit, uint32_t flags);
+
+    BalanceEntry* findAccount(AccountID account);
+    BalanceEntry const* findAccount(AccountID account) const;
+    BalanceEntry* findTrustLine(AccountID account, AssetID asset);
+    BalanceEntry const* findTrustLine(AccountID account, AssetID asset) const;
+
+    bool
+    isNative(AssetID asset) const
+    {
+        return mRegistry.asset(asset).type == ASSET_TYPE_NATIVE;
+    }
+
+    bool
+    isIssuer(AccountID account, AssetID asset) const
+    {
+        return mRegistry.asset(asset).issuer == account;
+    }
+
+    // The balance the account must keep: (2 + subentries + sponsoring -
+    // sponsored) base reserves.
+    int64_t minBalance(BalanceEntry const& account) const;
+
+    // Moves seller's liabilities for an offer selling `selling` for `buying`
+    // at price whose amount goes from oldAmount to newAmount. Throws
+    // std::overflow_error, changing nothing, if either side would leave
+    // [0, INT64_MAX].
+    void updateOfferLiabilities(AccountID seller, AssetID selling,
+                                AssetID buying, Price const& price,
+                                int64_t oldAmount, int64_t newAmount);
+
+    // Throws as updateOfferLiabilities would for an offer going from
+    // oldAmount at oldPrice to newAmount at newPrice, without changing
+    // anything; the books call it before they change an offer, so that a
+    // failed update leaves them as they were.
+    void checkOfferLiabilities(AccountID seller, AssetID selling,
+                               AssetID buying, Price const& oldPrice,
+                               int64_t oldAmount, Price const& newPrice,
+                               int64_t newAmount) const;
+
+    void checkLiabilities() const;
+
+    void
+    setCheckLiabilities(bool check)
+    {
+        mCheckLiabilities = check;
+    }
+
+    bool
+    checkingLiabilities() const
+    {
+        return mCheckLiabilities;
+    }
+
+    size_t
+    size() const
+    {
+        return mEntries.size();
+    }
+
+    void reserve(size_t entries);
+
+  private:
+    static uint64_t
+    lineKey(uint32_t accountIndex, AssetID asset)
+    {
+        return ((uint64_t)(accountIndex + 1) << 32) | asset;
+    }
+
+    // The entry an offer's liabilities in asset go to, if any.
+    BalanceEntry* liabilityEntry(AccountID account, AssetID asset);
+    BalanceEntry const* liabilityEntry(AccountID account,
+                                       AssetID asset) const;
+
+    BookRegistry const& mRegistry;
+    int64_t const mBaseReserve;
+    bool mCheckLiabilities{false};
+
+    std::vector<BalanceEntry> mEntries;
+    FlatHashMap64<uint32_t> mAccounts; // account to its native entry
+    FlatHashMap64<uint32_t> mLines;    // lineKey to trustline entry
+};
+
+// stellar-core's limits on what account can give and take in a crossing,
+// read from the store instead of the ledger. An account without the entry
+// can do neither; an issuer can do both without limit.
+// - canSellAtMost: the available balance, above the reserve and the selling
+//   liabilities, if the trustline is at least authorized to maintain
+//   liabilities.
+// - canBuyAtMost: what fits under the limit after the buying liabilities, if
+//   the trustline is authorized.
+// - canSellAtMostBasedOnSheep: the wheat whose worth at wheatPrice the
+//   account can still receive in sheep; unlimited for native sheep.
+int64_t canSellAtMost(AccountStore const& store, AccountID account,
+                      AssetID asset);
+int64_t canBuyAtMost(AccountStore const& store, AccountID account,
+                     AssetID asset);
+int64_t canSellAtMostBasedOnSheep(AccountStore const& store,
+                                  AccountID account, AssetID sheep,
+                                  Price const& wheatPrice);
+}
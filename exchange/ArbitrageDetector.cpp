@@ -0,0 +1,287 @@
+// Detection of profitable cycles over the pair graph of a BookRegistry
+
+#include "ArbitrageDetector.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace stellar
+{
+
+// Weight sums at or above this are not candidates; far beyond the rounding of
+// a handful of logarithms, far below any price difference an offer can have.
+static double const CANDIDATE_MARGIN = -1e-12;
+
+ArbitrageDetector::ArbitrageDetector(BookRegistry const& registry,
+                                     size_t maxLength)
+    : mRegistry(registry), mMaxLength(maxLength)
+{
+    releaseAssertOrThrow(maxLength >= 2 && maxLength <= PathPayment::MAX_HOPS);
+    mTrail.reserve(MAX_OFFERS_TO_CROSS + 1);
+    rebuildGraph();
+}
+
+void
+ArbitrageDetector::rebuildGraph()
+{
+    mEdges.clear();
+    mOut.assign(mRegistry.numAssets() + 1, {});
+    auto addEdge = [this](AssetID sheep, AssetID wheat) -> Edge& {
+        for (uint32_t i : mOut[sheep])
+        {
+            if (mEdges[i].to == wheat)
+            {
+                return mEdges[i];
+            }
+        }
+        mOut[sheep].push_back((uint32_t)mEdges.size());
+        mEdges.push_back(Edge{sheep, wheat, nullptr, nullptr, false, 0, 0, 0,
+                              0, 0});
+        return mEdges.back();
+    };
+    mRegistry.forEachBook(
+        [&addEdge](AssetID wheat, AssetID sheep, OrderBook const& book) {
+            addEdge(sheep, wheat).book = &book;
+        });
+    mRegistry.forEachPool(
+        [&addEdge](AssetID a, AssetID b, LiquidityPool const& pool) {
+            Edge& aToB = addEdge(a, b);
+            aToB.pool = &pool;
+            aToB.sheepIsA = true;
+            Edge& bToA = addEdge(b, a);
+            bToA.pool = &pool;
+            bToA.sheepIsA = false;
+        });
+    mOnStack.assign(mOut.size(), false);
+    mOpportunities.clear();
+    mCycleEdges.clear();
+    mAllChanged = true;
+}
+
+double
+ArbitrageDetector::weightOf(Edge const& edge)
+{
+    double rate = 0;
+    Offer best;
+    if (edge.book && edge.book->loadBestOffer(best))
+    {
+        rate = (double)best.price.d / best.price.n;
+    }
+    if (edge.pool)
+    {
+        int64_t reservesTo =
+            edge.sheepIsA ? edge.pool->reserveA : edge.pool->reserveB;
+        int64_t reservesFrom =
+            edge.sheepIsA ? edge.pool->reserveB : edge.pool->reserveA;
+        if (reservesTo > 0 && reservesFrom > 0)
+        {
+            rate = std::max(rate, (double)reservesFrom / reservesTo *
+                                      (10000 - edge.pool->feeBps) / 10000);
+        }
+    }
+    return rate > 0 ? -std::log(rate)
+                    : std::numeric_limits<double>::infinity();
+}
+
+void
+ArbitrageDetector::update()
+{
+    std::vector<uint32_t> changed;
+    mMinWeight = std::numeric_limits<double>::infinity();
+    for (uint32_t i = 0; i < mEdges.size(); ++i)
+    {
+        Edge& edge = mEdges[i];
+        bool moved = mAllChanged ||
+                     (edge.book && edge.book->version() != edge.version) ||
+                     (edge.pool && (edge.pool->reserveA != edge.reserveA ||
+                                    edge.pool->reserveB != edge.reserveB));
+        edge.changed = 0;
+        if (moved)
+        {
+            edge.version = edge.book ? edge.book->version() : 0;
+            edge.reserveA = edge.pool ? edge.pool->reserveA : 0;
+            edge.reserveB = edge.pool ? edge.pool->reserveB : 0;
+            edge.weight = weightOf(edge);
+            changed.push_back(i);
+            edge.changed = (uint32_t)changed.size();
+        }
+        mMinWeight = std::min(mMinWeight, edge.weight);
+    }
+    mAllChanged = false;
+
+    size_t kept = 0;
+    for (size_t i = 0; i < mOpportunities.size(); ++i)
+    {
+        auto const& edges = mCycleEdges[i];
+        bool touched = false;
+        for (size_t hop = 0; hop < mOpportunities[i].length; ++hop)
+        {
+            touched = touched || mEdges[edges[hop]].changed != 0;
+        }
+        if (!touched)
+        {
+            mOpportunities[kept] = mOpportunities[i];
+            mCycleEdges[kept] = edges;
+            ++kept;
+        }
+    }
+    mOpportunities.resize(kept);
+    mCycleEdges.resize(kept);
+
+    for (uint32_t i : changed)
+    {
+        Edge const& first = mEdges[i];
+        if (std::isinf(first.weight))
+        {
+            continue;
+        }
+        mStack.assign(1, i);
+        mOnStack[first.from] = mOnStack[first.to] = true;
+        extend(first.to, first.weight, first, first.changed);
+        mOnStack[first.from] = mOnStack[first.to] = false;
+    }
+}
+
+// Extends the cycle on mStack, which starts with first and has reached `at`
+// with weights summing to sum. Cycles through a changed edge that comes
+// before first (a lower order) were enumerated from that edge already.
+void
+ArbitrageDetector::extend(AssetID at, double sum, Edge const& first,
+                          uint32_t order)
+{
+    for (uint32_t i : mOut[at])
+    {
+        Edge const& edge = mEdges[i];
+        if (std::isinf(edge.weight) ||
+            (edge.changed != 0 && edge.changed < order))
+        {
+            continue;
+        }
+        double total = sum + edge.weight;
+        if (edge.to == first.from)
+        {
+            if (total < CANDIDATE_MARGIN)
+            {
+                mStack.push_back(i);
+                verify();
+                mStack.pop_back();
+            }
+            continue;
+        }
+        // At least one more edge closes the cycle, and at most the ones the
+        // length allows; none can weigh less than mMinWeight.
+        size_t rest = mMaxLength - mStack.size() - 1;
+        if (rest == 0 || mOnStack[edge.to] ||
+            total + (mMinWeight < 0 ? rest * mMinWeight : mMinWeight) >=
+                CANDIDATE_MARGIN)
+        {
+            continue;
+        }
+        mStack.push_back(i);
+        mOnStack[edge.to] = true;
+        extend(edge.to, total, first, order);
+        mOnStack[edge.to] = false;
+        mStack.pop_back();
+    }
+}
+
+// Strict-sends amountIn around the cycle on mStack. The cycle is simple, so
+// every book appears once; a two-pair cycle goes through the same pool twice
+// and sees its own first trade.
+bool
+ArbitrageDetector::quoteCycle(int64_t amountIn, int64_t& amountOut)
+{
+    std::array<LiquidityPool, PathPayment::MAX_HOPS> pools;
+    int64_t amount = amountIn;
+    for (size_t hop = 0; hop < mStack.size(); ++hop)
+    {
+        Edge const& edge = mEdges[mStack[hop]];
+        LiquidityPool* pool = nullptr;
+        if (edge.pool)
+        {
+            pool = &pools[hop];
+            *pool = *edge.pool;
+            for (size_t earlier = 0; earlier < hop; ++earlier)
+            {
+                if (mEdges[mStack[earlier]].pool == edge.pool)
+                {
+                    *pool = pools[earlier];
+                }
+            }
+        }
+        BookPosition position;
+        int64_t sheepSend, received, lastAmount;
+        mTrail.clear();
+        auto res = quoteWithOffersAndPools(
+            edge.book ? *edge.book : mEmptyBook, position, pool,
+            edge.sheepIsA, amount, sheepSend, INT64_MAX, received,
+            RoundingType::PATH_PAYMENT_STRICT_SEND, nullptr, mTrail,
+            MAX_OFFERS_TO_CROSS, lastAmount);
+        if (res != ConvertResult::eOK || sheepSend != amount || received <= 0)
+        {
+            return false;
+        }
+        amount = received;
+    }
+    amountOut = amount;
+    return true;
+}
+
+void
+ArbitrageDetector::verify()
+{
+    // Profit rises with the amount until the cycle runs into worse offers;
+    // keep doubling while it still may rise. Small amounts can fail only for
+    // being too small (a hop with a rate below 1 rounds them down to
+    // nothing), so failures before the first amount that goes round are
+    // skipped; after it, a failure means the cycle ran out of depth.
+    int64_t bestIn = 0;
+    int64_t bestOut = 0;
+    bool wentRound = false;
+    for (int64_t in = 1;; in *= 2)
+    {
+        int64_t out;
+        if (!quoteCycle(in, out))
+        {
+            if (wentRound || in > INT64_MAX / 2)
+            {
+                break;
+            }
+            continue;
+        }
+        wentRound = true;
+        if (out - in > bestOut - bestIn)
+        {
+            bestIn = in;
+            bestOut = out;
+        }
+        else if (bestOut > bestIn)
+        {
+            break;
+        }
+        if (in > INT64_MAX / 2)
+        {
+            break;
+        }
+    }
+    if (bestOut <= bestIn)
+    {
+        return;
+    }
+
+    Arbitrage found;
+    std::array<uint32_t, PathPayment::MAX_HOPS> edges;
+    found.length = mStack.size();
+    for (size_t hop = 0; hop < mStack.size(); ++hop)
+    {
+        found.cycle[hop] = mEdges[mStack[hop]].from;
+        edges[hop] = mStack[hop];
+    }
+    found.cycle[found.length] = found.cycle[0];
+    found.amountIn = bestIn;
+    found.amountOut = bestOut;
+    mOpportunities.push_back(found);
+    mCycleEdges.push_back(edges);
+}
+}
@@ -0,0 +1,104 @@
+// Detection of profitable cycles over the pair graph of a BookRegistry
+#pragma once
+
+#include <array>
+#include <vector>
+#include <cstdint>
+
+#include "BookRegistry.h"
+#include "OrderBook.h"
+#include "PathPayment.h"
+
+namespace stellar
+{
+
+// A cycle of conversions that ends with more of cycle[0] than it started
+// with: strict-sending amountIn of cycle[0] along cycle[0], cycle[1], ...,
+// cycle[length] == cycle[0] delivers amountOut > amountIn.
+struct Arbitrage
+{
+    std::array<AssetID, PathPayment::MAX_HOPS + 1> cycle;
+    size_t length;
+    int64_t amountIn;
+    int64_t amountOut;
+};
+
+// ArbitrageDetector keeps the profitable simple cycles of up to maxLength
+// pairs over the books and pools of a registry, after exact rounding.
+//
+// Each direction of a pair is an edge weighted by -log of the best rate it
+// gives: the price of its best offer, or the pool's marginal rate after its
+// fee. A cycle whose weights add up to less than 0 is a candidate, and only
+// candidates are verified, by quoting the cycle as a path payment strict send
+// (quoteWithOffersAndPools: exchangeV10 with its price error thresholds, and
+// exchangeWithPool) for a doubling series of amounts; the cycle is kept with
+// the most profitable of them if any profits. The weights are only used to
+// prune, so a rate rounded by the floating point logarithm can at worst cost
+// a verification; a cycle that only breaks even at the best prices can gain
+// no more than rounding dust and is not searched for.
+//
+// Updates are incremental. update() finds the pairs whose book or pool changed
+// since the last call (OrderBook::version, the pool reserves), drops the kept
+// cycles through them, and re-evaluates only the cycles that go through at
+// least one of them; each such cycle is enumerated once, from the first
+// changed edge it contains. The enumeration is a depth-first search from the
+// head of a changed edge back to its tail, cut off once even the lightest
+// edges in the graph could no longer bring the sum below 0. Call it after
+// each ledger close; rebuildGraph picks up new pairs, after which everything
+// counts as changed.
+//
+// Like PathFinder, the registry must not change during a call.
+class ArbitrageDetector
+{
+  public:
+    ArbitrageDetector(BookRegistry const& registry, size_t maxLength);
+
+    void rebuildGraph();
+    void update();
+
+    std::vector<Arbitrage> const&
+    opportunities() const
+    {
+        return mOpportunities;
+    }
+
+  private:
+    // One direction of a pair: selling `from` (sheep) for `to` (wheat).
+    struct Edge
+    {
+        AssetID from;
+        AssetID to;
+        OrderBook const* book;
+        LiquidityPool const* pool;
+        bool sheepIsA;
+        double weight;     // -log of the best rate; infinite if none
+        uint64_t version;  // of the book when last seen
+        int64_t reserveA;  // of the pool when last seen
+        int64_t reserveB;
+        uint32_t changed;  // 1 + position among the changed edges, or 0
+    };
+
+    static double weightOf(Edge const& edge);
+    void extend(AssetID at, double sum, Edge const& first, uint32_t order);
+    void verify();
+    bool quoteCycle(int64_t amountIn, int64_t& amountOut);
+
+    BookRegistry const& mRegistry;
+    size_t const mMaxLength;
+    OrderBook mEmptyBook; // stands in for pairs with only a pool
+
+    std::vector<Edge> mEdges;
+    std::vector<std::vector<uint32_t>> mOut; // edge indices by sheep asset
+    bool mAllChanged{true};
+    double mMinWeight{0};
+
+    std::vector<Arbitrage> mOpportunities;
+    // The edges of each opportunity, to drop it when one changes.
+    std::vector<std::array<uint32_t, PathPayment::MAX_HOPS>> mCycleEdges;
+
+    // Search state: the edges of the cycle being built.
+    std::vector<uint32_t> mStack;
+    std::vector<bool> mOnStack; // by asset
+    std::vector<ClaimAtom> mTrail;
+};
+}
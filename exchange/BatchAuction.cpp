@@ -0,0 +1,234 @@
+// Batch auction clearing of the two books of a pair at one uniform price
+
+#include "BatchAuction.h"
+
+#include <algorithm>
+
+namespace stellar
+{
+
+// As in OrderBook.cpp: positive int32_t terms, so the products fit int64_t.
+static int
+comparePrice(Price const& a, Price const& b)
+{
+    int64_t lhs = (int64_t)a.n * (int64_t)b.d;
+    int64_t rhs = (int64_t)b.n * (int64_t)a.d;
+    return (lhs < rhs) ? -1 : (lhs > rhs ? 1 : 0);
+}
+
+bool
+findClearingPrice(OrderBook const& wheatBook, OrderBook const& sheepBook,
+                  Price& price)
+{
+    std::vector<DepthLevel> asks;
+    std::vector<DepthLevel> bids;
+    wheatBook.getDepth(asks, wheatBook.numLevels());
+    sheepBook.getDepth(bids, sheepBook.numLevels());
+
+    // A bid level's limit in sheep per wheat; the sheep book lists the
+    // highest limits first, so bids[b - 1] has the lowest still counted.
+    auto limit = [&](size_t i) {
+        return Price{bids[i].price.d, bids[i].price.n};
+    };
+
+    int64_t supply = 0; // wheat asked at or below the candidate
+    int64_t demand = 0; // sheep bid at or above it
+    for (auto const& level : bids)
+    {
+        demand += level.amount;
+    }
+
+    bool found = false;
+    int64_t bestVolume = 0;
+    int64_t bestImbalance = 0;
+    size_t a = 0;
+    size_t b = bids.size();
+    while (b > 0 && demand > 0)
+    {
+        Price candidate = (a < asks.size() &&
+                           comparePrice(asks[a].price, limit(b - 1)) <= 0)
+                              ? asks[a].price
+                              : limit(b - 1);
+        while (a < asks.size() && comparePrice(asks[a].price, candidate) <= 0)
+        {
+            supply += asks[a++].amount;
+        }
+
+        int64_t wheatDemand;
+        if (!bigDivide128(wheatDemand, bigMultiply(demand, candidate.d),
+                          candidate.n, ROUND_DOWN))
+        {
+            wheatDemand = INT64_MAX;
+        }
+        int64_t volume = std::min(supply, wheatDemand);
+        int64_t imbalance = std::max(supply, wheatDemand) - volume;
+        if (volume > 0 &&
+            (volume > bestVolume ||
+             (volume == bestVolume && imbalance < bestImbalance)))
+        {
+            found = true;
+            price = candidate;
+            bestVolume = volume;
+            bestImbalance = imbalance;
+        }
+
+        while (b > 0 && comparePrice(limit(b - 1), candidate) <= 0)
+        {
+            demand -= bids[--b].amount;
+        }
+    }
+    return found;
+}
+
+namespace
+{
+// The final amount of an order the matching touched.
+struct AmountUpdate
+{
+    int64_t offerID;
+    int64_t amount;
+};
+
+// An order being matched and the amount it started the auction with.
+struct Working
+{
+    Offer offer;
+    int64_t original;
+    bool active{false};
+
+    void
+    finish(std::vector<AmountUpdate>& updates)
+    {
+        if (offer.amount != original)
+        {
+            updates.push_back(AmountUpdate{offer.offerID, offer.amount});
+        }
+        active = false;
+    }
+};
+}
+
+bool
+clearBatchAuction(OrderBook& wheatBook, OrderBook& sheepBook, Price& price,
+                  std::vector<AuctionMatch>& matches)
+{
+    if (!findClearingPrice(wheatBook, sheepBook, price))
+    {
+        return false;
+    }
+    Price const inverse{price.d, price.n};
+
+    // Matching only reads the books, through cursors; the fills are applied
+    // afterwards, when no cursor is open.
+    size_t const first = matches.size();
+    std::vector<AmountUpdate> askUpdates;
+    std::vector<AmountUpdate> bidUpdates;
+    {
+        OrderBook::Cursor asks(wheatBook);
+        OrderBook::Cursor bids(sheepBook);
+        Working ask;
+        Working bid;
+        while (true)
+        {
+            if (!ask.active)
+            {
+                if (!asks.next(ask.offer) ||
+                    comparePrice(ask.offer.price, price) > 0)
+                {
+                    break;
+                }
+                ask.original = ask.offer.amount;
+                ask.active = true;
+            }
+            if (!bid.active)
+            {
+                if (!bids.next(bid.offer) ||
+                    comparePrice(bid.offer.price, inverse) > 0)
+                {
+                    break;
+                }
+                bid.original = bid.offer.amount;
+                bid.active = true;
+            }
+
+            auto res = exchangeV10(price, ask.offer.amount, INT64_MAX,
+                                   bid.offer.amount, INT64_MAX,
+                                   RoundingType::NORMAL);
+            bool traded = res.numWheatReceived > 0;
+            if (traded)
+            {
+                matches.push_back(AuctionMatch{
+                    ask.offer.sellerID, ask.offer.offerID, bid.offer.sellerID,
+                    bid.offer.offerID, res.numWheatReceived,
+                    res.numSheepSend});
+                ask.offer.amount -= res.numWheatReceived;
+                bid.offer.amount -= res.numSheepSend;
+            }
+
+            // Whichever side bound the trade is done at this price; the other
+            // keeps what adjustOffer leaves it, as in crossOfferV10.
+            if (res.wheatStays)
+            {
+                bid.offer.amount =
+                    adjustOffer(bid.offer.price, bid.offer.amount, INT64_MAX);
+                bid.finish(bidUpdates);
+                ask.offer.amount =
+                    adjustOffer(ask.offer.price, ask.offer.amount, INT64_MAX);
+                if (ask.offer.amount == 0)
+                {
+                    ask.finish(askUpdates);
+                }
+            }
+            else
+            {
+                if (traded)
+                {
+                    ask.offer.amount = 0;
+                }
+                ask.finish(askUpdates);
+                bid.offer.amount =
+                    adjustOffer(bid.offer.price, bid.offer.amount, INT64_MAX);
+                if (bid.offer.amount == 0)
+                {
+                    bid.finish(bidUpdates);
+                }
+            }
+        }
+        if (ask.active)
+        {
+            ask.finish(askUpdates);
+        }
+        if (bid.active)
+        {
+            bid.finish(bidUpdates);
+        }
+    }
+
+    // The trades go out ahead of the level updates they cause.
+    MarketDataFeed* askFeed = wheatBook.marketDataFeed();
+    MarketDataFeed* bidFeed = sheepBook.marketDataFeed();
+    for (size_t i = first; i < matches.size(); ++i)
+    {
+        auto const& m = matches[i];
+        if (askFeed)
+        {
+            askFeed->publish(MarketDataEventType::TRADE, price, m.wheat,
+                             m.sheep, m.askOfferID, m.askSellerID);
+        }
+        if (bidFeed)
+        {
+            bidFeed->publish(MarketDataEventType::TRADE, inverse, m.sheep,
+                             m.wheat, m.bidOfferID, m.bidSellerID);
+        }
+    }
+    for (auto const& update : askUpdates)
+    {
+        wheatBook.setOfferAmount(update.offerID, update.amount);
+    }
+    for (auto const& update : bidUpdates)
+    {
+        sheepBook.setOfferAmount(update.offerID, update.amount);
+    }
+    return true;
+}
+}
@@ -0,0 +1,58 @@
+// Batch auction clearing of the two books of a pair at one uniform price
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "OfferExchange.h"
+#include "OrderBook.h"
+
+namespace stellar
+{
+
+// One trade of a batch auction: the ask (an offer in the wheat book, selling
+// wheat for sheep) sold wheat to the bid (an offer in the sheep book, selling
+// sheep for wheat) for sheep.
+struct AuctionMatch
+{
+    AccountID askSellerID;
+    int64_t askOfferID;
+    AccountID bidSellerID;
+    int64_t bidOfferID;
+    int64_t wheat;
+    int64_t sheep;
+};
+
+// Batch auction mode for a pair, as an alternative to crossing each order as
+// it arrives. During an interval the pair's orders are only added to its two
+// books, wheatBook (selling wheat for sheep, the asks) and sheepBook (selling
+// sheep for wheat, the bids), which may leave them crossed; nothing is
+// serialized behind a crossing loop. At the end of the interval one call
+// clears both books at a single price.
+//
+// The price is found on the level aggregates alone, in O(levels of both
+// books): every ask level and bid limit is a candidate, and a merged sweep
+// over them in ascending price keeps the wheat offered at or below the
+// candidate and the sheep bid at or above it. The candidate that trades the
+// most wheat wins (volume only changes at a candidate, and between two it is
+// highest at the lower one), then the one that leaves the least unmatched,
+// then the lowest.
+//
+// Fills are then allocated in each book's own priority (price, then arrival):
+// the best ask and the best bid trade at the clearing price through
+// exchangeV10 with NORMAL rounding, exactly as a bid crossing the ask would,
+// with the 1% price error threshold; whichever side is used up moves on to
+// its next order, and remainders are adjusted with adjustOffer as the
+// crossing loop does. An order too small to trade at the clearing price is
+// left where it is. Only the orders that trade are visited, and the books are
+// updated once the matching is done (with trade events for an attached feed).
+//
+// findClearingPrice returns false if the books do not cross;
+// clearBatchAuction then returns false and changes nothing. Matches are
+// appended in the order they were made.
+bool findClearingPrice(OrderBook const& wheatBook, OrderBook const& sheepBook,
+                       Price& price);
+
+bool clearBatchAuction(OrderBook& wheatBook, OrderBook& sheepBook,
+                       Price& price, std::vector<AuctionMatch>& matches);
+}
@@ -0,0 +1,182 @@
+// Registry of the in-memory order books of every asset pair
+
+#include "BookRegistry.h"
+
+#include <cstring>
+#include <stdexcept>
+
+namespace stellar
+{
+
+size_t
+BookRegistry::AssetHash::operator()(Asset const& asset) const
+{
+    uint64_t lo = 0, hi = 0;
+    std::memcpy(&lo, asset.code, sizeof(lo));
+    std::memcpy(&hi, asset.code + sizeof(lo), sizeof(asset.code) - sizeof(lo));
+    uint64_t h = asset.issuer * 0x9E3779B97F4A7C15ull;
+    h ^= (lo + asset.type) * 0xBF58476D1CE4E5B9ull;
+    h ^= hi * 0x94D049BB133111EBull;
+    return (size_t)(h ^ (h >> 31));
+}
+
+AssetID
+BookRegistry::intern(Asset const& asset)
+{
+    auto it = mAssetIDs.find(asset);
+    if (it != mAssetIDs.end())
+    {
+        return it->second;
+    }
+    if (mAssets.size() == UINT32_MAX)
+    {
+        throw std::overflow_error("too many assets");
+    }
+    mAssets.push_back(asset);
+    AssetID id = (AssetID)mAssets.size();
+    mAssetIDs.emplace(asset, id);
+    return id;
+}
+
+AssetID
+BookRegistry::find(Asset const& asset) const
+{
+    auto it = mAssetIDs.find(asset);
+    return it == mAssetIDs.end() ? 0 : it->second;
+}
+
+void
+BookRegistry::checkAsset(AssetID id) const
+{
+    if (id == 0 || id > mAssets.size())
+    {
+        throw std::runtime_error("unknown asset");
+    }
+}
+
+Asset const&
+BookRegistry::asset(AssetID id) const
+{
+    checkAsset(id);
+    return mAssets[id - 1];
+}
+
+OrderBook&
+BookRegistry::book(AssetID wheat, AssetID sheep)
+{
+    if (auto book = findBook(wheat, sheep))
+    {
+        return *book;
+    }
+    checkAsset(wheat);
+    checkAsset(sheep);
+    if (wheat == sheep)
+    {
+        throw std::runtime_error("wheat and sheep must differ");
+    }
+    mBookIndex.insert(pairKey(wheat, sheep), (uint32_t)mBooks.size());
+    mBooks.emplace_back(new OrderBook());
+    if (mAccounts)
+    {
+        mBooks.back()->setAccountStore(mAccounts, wheat, sheep);
+    }
+    return *mBooks.back();
+}
+
+void
+BookRegistry::setAccountStore(AccountStore* store)
+{
+    mAccounts = store;
+    mBookIndex.forEach([&](uint64_t key, uint32_t index) {
+        mBooks[index]->setAccountStore(store, (AssetID)(key >> 32),
+                                       (AssetID)key);
+    });
+}
+
+OrderBook*
+BookRegistry::findBook(AssetID wheat, AssetID sheep)
+{
+    auto index = mBookIndex.find(pairKey(wheat, sheep));
+    return index ? mBooks[*index].get() : nullptr;
+}
+
+OrderBook const*
+BookRegistry::findBook(AssetID wheat, AssetID sheep) const
+{
+    auto index = mBookIndex.find(pairKey(wheat, sheep));
+    return index ? mBooks[*index].get() : nullptr;
+}
+
+BookRegistry::PairEntry*
+BookRegistry::findPair(AssetID x, AssetID y)
+{
+    auto index = mPairIndex.find(x < y ? pairKey(x, y) : pairKey(y, x));
+    return index ? &mPairs[*index] : nullptr;
+}
+
+BookRegistry::PairEntry const*
+BookRegistry::findPair(AssetID x, AssetID y) const
+{
+    auto index = mPairIndex.find(x < y ? pairKey(x, y) : pairKey(y, x));
+    return index ? &mPairs[*index] : nullptr;
+}
+
+BookRegistry::PairEntry&
+BookRegistry::pair(AssetID x, AssetID y)
+{
+    if (auto entry = findPair(x, y))
+    {
+        return *entry;
+    }
+    Asset const& ax = asset(x);
+    Asset const& ay = asset(y);
+    PoolID id = getPoolID(ax, ay, LIQUIDITY_POOL_FEE_V18);
+    mPairIndex.insert(x < y ? pairKey(x, y) : pairKey(y, x),
+                      (uint32_t)mPairs.size());
+    mPairs.push_back(PairEntry{id, ax < ay ? x : y, nullptr});
+    return mPairs.back();
+}
+
+PoolID
+BookRegistry::poolID(AssetID x, AssetID y)
+{
+    return pair(x, y).poolID;
+}
+
+LiquidityPool&
+BookRegistry::pool(AssetID x, AssetID y, bool& xIsA)
+{
+    PairEntry& entry = pair(x, y);
+    if (!entry.pool)
+    {
+        entry.pool.reset(new LiquidityPool{0, 0, LIQUIDITY_POOL_FEE_V18});
+        ++mNumPools;
+    }
+    xIsA = entry.assetA == x;
+    return *entry.pool;
+}
+
+LiquidityPool*
+BookRegistry::findPool(AssetID x, AssetID y, bool& xIsA)
+{
+    PairEntry* entry = findPair(x, y);
+    if (!entry || !entry->pool)
+    {
+        return nullptr;
+    }
+    xIsA = entry->assetA == x;
+    return entry->pool.get();
+}
+
+LiquidityPool const*
+BookRegistry::findPool(AssetID x, AssetID y, bool& xIsA) const
+{
+    PairEntry const* entry = findPair(x, y);
+    if (!entry || !entry->pool)
+    {
+        return nullptr;
+    }
+    xIsA = entry->assetA == x;
+    return entry->pool.get();
+}
+}
@@ -0,0 +1,151 @@
+// Registry of the in-memory order books of every asset pair
+#pragma once
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+
+#include "OfferExchange.h"
+#include "FlatHashMap.h"
+#include "OrderBook.h"
+
+namespace stellar
+{
+
+// BookRegistry owns one OrderBook per ordered (wheat, sheep) pair.
+//
+// Assets are interned once, when they enter the system (a transaction is
+// decoded, a dump is loaded), and everything past that point works on AssetIDs.
+// A pair then packs into the 64-bit key (wheat << 32) | sheep, and finding its
+// book is a single FlatHashMap64 probe instead of hashing and comparing Asset
+// structs. Path finding and settlement look up many pairs per transaction, so
+// this is the lookup that matters; interning itself goes through an ordinary
+// hash map.
+//
+// The registry also holds the liquidity pool of each unordered pair and
+// memoizes pool IDs: getPoolID hashes the XDR of the pair, which is far more
+// work than the probe that finds a cached ID.
+//
+// Books and pools are allocated individually, so references to them stay valid
+// as the registry grows.
+class BookRegistry
+{
+  public:
+    // The ID of asset, interning it first if it is new.
+    AssetID intern(Asset const& asset);
+
+    // The ID of asset, or 0 if it was never interned.
+    AssetID find(Asset const& asset) const;
+
+    Asset const& asset(AssetID id) const;
+
+    size_t
+    numAssets() const
+    {
+        return mAssets.size();
+    }
+
+    static uint64_t
+    pairKey(AssetID wheat, AssetID sheep)
+    {
+        return ((uint64_t)wheat << 32) | sheep;
+    }
+
+    // The book of offers selling wheat for sheep, created empty on first use.
+    OrderBook& book(AssetID wheat, AssetID sheep);
+
+    // Attaches store to every book, including the ones created later (see
+    // OrderBook::setAccountStore); nullptr detaches it.
+    void setAccountStore(AccountStore* store);
+
+    // The same, but nullptr if the book was never created.
+    OrderBook* findBook(AssetID wheat, AssetID sheep);
+    OrderBook const* findBook(AssetID wheat, AssetID sheep) const;
+
+    size_t
+    numBooks() const
+    {
+        return mBooks.size();
+    }
+
+    // Calls f(wheat, sheep, book) for every book, in no particular order.
+    template <typename F>
+    void
+    forEachBook(F f) const
+    {
+        mBookIndex.forEach([&](uint64_t key, uint32_t index) {
+            f((AssetID)(key >> 32), (AssetID)key,
+              (OrderBook const&)*mBooks[index]);
+        });
+    }
+
+    // The ID of the pool between x and y with the standard fee, in either
+    // order. Computed once per pair.
+    PoolID poolID(AssetID x, AssetID y);
+
+    // The pool between x and y, created empty (zero reserves, standard fee)
+    // on first use. Its A side is whichever of x and y sorts first as an
+    // Asset; xIsA tells the caller which one that is.
+    LiquidityPool& pool(AssetID x, AssetID y, bool& xIsA);
+
+    // The same, but nullptr if the pool was never created.
+    LiquidityPool* findPool(AssetID x, AssetID y, bool& xIsA);
+    LiquidityPool const* findPool(AssetID x, AssetID y, bool& xIsA) const;
+
+    // Calls f(assetA, assetB, pool) for every pool, in no particular order.
+    template <typename F>
+    void
+    forEachPool(F f) const
+    {
+        mPairIndex.forEach([&](uint64_t key, uint32_t index) {
+            PairEntry const& entry = mPairs[index];
+            if (entry.pool)
+            {
+                AssetID x = (AssetID)(key >> 32);
+                AssetID y = (AssetID)key;
+                f(entry.assetA, entry.assetA == x ? y : x,
+                  (LiquidityPool const&)*entry.pool);
+            }
+        });
+    }
+
+    size_t
+    numPools() const
+    {
+        return mNumPools;
+    }
+
+  private:
+    struct AssetHash
+    {
+        size_t operator()(Asset const& asset) const;
+    };
+
+    // Everything known about an unordered pair; the pool itself only exists
+    // once created.
+    struct PairEntry
+    {
+        PoolID poolID;
+        AssetID assetA;
+        std::unique_ptr<LiquidityPool> pool;
+    };
+
+    void checkAsset(AssetID id) const;
+    PairEntry* findPair(AssetID x, AssetID y);
+    PairEntry const* findPair(AssetID x, AssetID y) const;
+    PairEntry& pair(AssetID x, AssetID y);
+
+    std::unordered_map<Asset, AssetID, AssetHash> mAssetIDs;
+    std::vector<Asset> mAssets; // mAssets[id - 1]
+
+    std::vector<std::unique_ptr<OrderBook>> mBooks;
+    FlatHashMap64<uint32_t> mBookIndex; // pair key -> index into mBooks
+    AccountStore* mAccounts{nullptr};
+
+    // Keyed by pairKey(min(x, y), max(x, y)).
+    std::vector<PairEntry> mPairs;
+    FlatHashMap64<uint32_t> mPairIndex; // pair key -> index into mPairs
+    size_t mNumPools{0};
+};
+}
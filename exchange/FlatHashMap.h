@@ -0,0 +1,209 @@
+// Open-addressing hash map used by the in-memory order book for its lookup
+// tables.
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "OfferExchange.h"
+
+namespace stellar
+{
+
+// FlatHashMap64 maps non-zero 64-bit keys to small trivially-copyable values.
+//
+// Slots live in one power-of-two array and collisions are resolved by linear
+// probing, so a lookup is a multiply, a shift and (almost always) a single
+// cache line. Key 0 marks an empty slot, which is why callers must never insert
+// it: offer IDs are positive and interned IDs are handed out starting from 1.
+//
+// The table grows once it is three quarters full. Linear probing is still
+// short at that load, and it keeps the index at 16-32 bytes per key, which
+// matters when the book holds tens of millions of offers.
+//
+// Erasure uses backward-shift deletion instead of tombstones. Makers cancel and
+// replace offers constantly; with tombstones that churn would slowly fill the
+// table with dead slots and stretch every probe sequence, whereas backward
+// shifting keeps the table exactly as if the erased key had never been
+// inserted.
+template <typename V> class FlatHashMap64
+{
+  public:
+    struct Slot
+    {
+        uint64_t key;
+        V value;
+    };
+
+    FlatHashMap64()
+    {
+        rehash(MIN_CAPACITY);
+    }
+
+    size_t
+    size() const
+    {
+        return mSize;
+    }
+
+    size_t
+    capacity() const
+    {
+        return mSlots.size();
+    }
+
+    V*
+    find(uint64_t key)
+    {
+        size_t i = probe(key);
+        return mSlots[i].key == key ? &mSlots[i].value : nullptr;
+    }
+
+    V const*
+    find(uint64_t key) const
+    {
+        size_t i = probe(key);
+        return mSlots[i].key == key ? &mSlots[i].value : nullptr;
+    }
+
+    // Returns false (and leaves the map unchanged) if key is already present.
+    bool
+    insert(uint64_t key, V const& value)
+    {
+        releaseAssertOrThrow(key != 0);
+        if ((mSize + 1) * 4 > mSlots.size() * 3)
+        {
+            rehash(mSlots.size() * 2);
+        }
+        size_t i = probe(key);
+        if (mSlots[i].key == key)
+        {
+            return false;
+        }
+        mSlots[i].key = key;
+        mSlots[i].value = value;
+        ++mSize;
+        return true;
+    }
+
+    bool
+    erase(uint64_t key)
+    {
+        size_t i = probe(key);
+        if (mSlots[i].key != key)
+        {
+            return false;
+        }
+
+        // Walk the cluster after the hole and pull back every entry whose home
+        // bucket does not lie cyclically in (i, j]; such an entry would become
+        // unreachable if the hole at i were left empty.
+        size_t const mask = mSlots.size() - 1;
+        size_t j = i;
+        while (true)
+        {
+            j = (j + 1) & mask;
+            if (mSlots[j].key == 0)
+            {
+                break;
+            }
+            size_t k = home(mSlots[j].key);
+            bool stays = (i <= j) ? (i < k && k <= j) : (i < k || k <= j);
+            if (!stays)
+            {
+                mSlots[i] = mSlots[j];
+                i = j;
+            }
+        }
+        mSlots[i].key = 0;
+        --mSize;
+        return true;
+    }
+
+    // Sizes the table so that n keys fit without rehashing.
+    void
+    reserve(size_t n)
+    {
+        size_t cap = mSlots.size();
+        while (cap * 3 < n * 4)
+        {
+            cap *= 2;
+        }
+        if (cap != mSlots.size())
+        {
+            rehash(cap);
+        }
+    }
+
+    void
+    clear()
+    {
+        for (auto& s : mSlots)
+        {
+            s.key = 0;
+        }
+        mSize = 0;
+    }
+
+    template <typename F>
+    void
+    forEach(F f) const
+    {
+        for (auto const& s : mSlots)
+        {
+            if (s.key != 0)
+            {
+                f(s.key, s.value);
+            }
+        }
+    }
+
+  private:
+    static size_t const MIN_CAPACITY = 16;
+
+    size_t
+    home(uint64_t key) const
+    {
+        // Fibonacci hashing: sequential keys (offer IDs are allocated
+        // sequentially) land far apart.
+        return (size_t)((key * 0x9E3779B97F4A7C15ull) >> mShift);
+    }
+
+    // Index of the slot holding key, or of the empty slot where it would go.
+    size_t
+    probe(uint64_t key) const
+    {
+        size_t const mask = mSlots.size() - 1;
+        size_t i = home(key);
+        while (mSlots[i].key != key && mSlots[i].key != 0)
+        {
+            i = (i + 1) & mask;
+        }
+        return i;
+    }
+
+    void
+    rehash(size_t cap)
+    {
+        std::vector<Slot> old;
+        old.swap(mSlots);
+        mSlots.assign(cap, Slot{0, V{}});
+        mShift = 64;
+        for (size_t c = cap; c > 1; c >>= 1)
+        {
+            --mShift;
+        }
+        for (auto const& s : old)
+        {
+            if (s.key != 0)
+            {
+                mSlots[probe(s.key)] = s;
+            }
+        }
+    }
+
+    std::vector<Slot> mSlots;
+    size_t mSize{0};
+    unsigned mShift{64};
+};
+}
@@ -0,0 +1,65 @@
+// Incremental market-data feed produced by the in-memory order book
+
+#include "MarketDataFeed.h"
+
+namespace stellar
+{
+
+MarketDataFeed::MarketDataFeed(size_t capacity)
+{
+    size_t cap = 1;
+    while (cap < capacity)
+    {
+        cap *= 2;
+    }
+    mSlots.reset(new Slot[cap]);
+    mMask = cap - 1;
+}
+
+void
+MarketDataFeed::publish(MarketDataEventType type, Price const& price,
+                        int64_t amount, int64_t count, int64_t offerID,
+                        AccountID sellerID)
+{
+    uint64_t seq = mNext.load(std::memory_order_relaxed);
+    Slot& slot = mSlots[seq & mMask];
+
+    // Mark the slot as being written before touching the payload, so that a
+    // reader racing with us sees a sequence mismatch on its second check.
+    slot.seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot.event.seq = seq;
+    slot.event.price = price;
+    slot.event.amount = amount;
+    slot.event.count = count;
+    slot.event.offerID = offerID;
+    slot.event.sellerID = sellerID;
+    slot.event.type = type;
+
+    slot.seq.store(seq, std::memory_order_release);
+    mNext.store(seq + 1, std::memory_order_release);
+}
+
+MarketDataFeed::ReadResult
+MarketDataFeed::read(uint64_t seq, MarketDataEvent& event) const
+{
+    if (seq == 0 || seq >= mNext.load(std::memory_order_acquire))
+    {
+        return ReadResult::eNotYet;
+    }
+
+    Slot const& slot = mSlots[seq & mMask];
+    if (slot.seq.load(std::memory_order_acquire) != seq)
+    {
+        return ReadResult::eOverwritten;
+    }
+    event = slot.event;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.seq.load(std::memory_order_relaxed) != seq)
+    {
+        return ReadResult::eOverwritten;
+    }
+    return ReadResult::eOK;
+}
+}
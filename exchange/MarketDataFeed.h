@@ -0,0 +1,83 @@
+// Incremental market-data feed produced by the in-memory order book
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <cstdint>
+
+#include "OfferExchange.h"
+
+namespace stellar
+{
+
+enum class MarketDataEventType : uint8_t
+{
+    LEVEL_ADD,    // a price level appeared
+    LEVEL_MODIFY, // a price level's aggregate changed
+    LEVEL_DELETE, // a price level emptied
+    TRADE         // an offer in the book was crossed
+};
+
+// One fixed-size feed record. For level events amount is the new aggregate
+// depth of the level (0 for LEVEL_DELETE) and count its number of offers. For
+// trades amount is the wheat sold by the offer in the book, count the sheep it
+// bought, and offerID/sellerID identify it.
+struct MarketDataEvent
+{
+    uint64_t seq;
+    Price price;
+    int64_t amount;
+    int64_t count;
+    int64_t offerID;
+    AccountID sellerID;
+    MarketDataEventType type;
+};
+
+// MarketDataFeed is a single-producer ring buffer of MarketDataEvents. The
+// matching thread publishes events while it crosses offers; consumers follow
+// the sequence numbers, which start at 1 and have no gaps.
+//
+// Publishing never blocks and never allocates: all slots are allocated up
+// front and the producer simply overwrites the oldest event once the ring is
+// full. Consumers may read from other threads. Each slot carries its own
+// sequence number, written last by the producer, so a reader can tell when the
+// slot it copied was overwritten underneath it; a consumer that falls a full
+// ring behind gets eOverwritten and must resynchronise from a snapshot
+// (OrderBook::getDepth).
+class MarketDataFeed
+{
+  public:
+    enum class ReadResult
+    {
+        eOK,
+        eNotYet,
+        eOverwritten
+    };
+
+    // capacity is rounded up to a power of two.
+    explicit MarketDataFeed(size_t capacity);
+
+    void publish(MarketDataEventType type, Price const& price, int64_t amount,
+                 int64_t count, int64_t offerID = 0, AccountID sellerID = 0);
+
+    // Sequence number the next published event will get.
+    uint64_t
+    nextSequence() const
+    {
+        return mNext.load(std::memory_order_acquire);
+    }
+
+    ReadResult read(uint64_t seq, MarketDataEvent& event) const;
+
+  private:
+    struct Slot
+    {
+        std::atomic<uint64_t> seq{0};
+        MarketDataEvent event;
+    };
+
+    std::unique_ptr<Slot[]> mSlots;
+    size_t mMask;
+    std::atomic<uint64_t> mNext{1};
+};
+}
@@ -2,6 +2,8 @@
 
 #include "OfferExchange.h"
 
+#include <cstring>
+
 struct ExchangedQuantities
 {
     int64_t sheepSend{0};
@@ -138,6 +140,43 @@ uint128_t bigMultiply(int64_t a, int64_t b)
     return bigMultiplyUnsigned((uint64_t)a, (uint64_t)b);
 }
 
+bool
+hugeDivide(int64_t& result, int32_t a, uint128_t const& B, uint128_t const& C,
+           Rounding rounding)
+{
+    releaseAssertOrThrow(a >= 0);
+    releaseAssertOrThrow(C > 0u);
+
+    // Write B = Q * C + R with 0 <= R < C, so that
+    //     a * B / C = a * Q + a * R / C.
+    // Since C < INT32_MAX * INT64_MAX we have a * R < INT32_MAX * C < 2^125,
+    // so neither a * R nor a * R + C - 1 can overflow uint128_t. If a * Q
+    // alone exceeds INT64_MAX then so does the result.
+    uint128_t const INT64_MAX_128((uint64_t)INT64_MAX);
+    uint128_t const A((uint64_t)a);
+    uint128_t const Q = B / C;
+    uint128_t const R = B % C;
+
+    if (a == 0)
+    {
+        result = 0;
+        return true;
+    }
+    if (Q > INT64_MAX_128 / A)
+    {
+        return false;
+    }
+
+    uint128_t const aR = A * R;
+    uint128_t x = A * Q + (rounding == ROUND_DOWN ? aR / C : (aR + C - 1u) / C);
+    if (x > INT64_MAX_128)
+    {
+        return false;
+    }
+    result = (int64_t)(uint64_t)x;
+    return true;
+}
+
 /* Excerpt from OfferExchange.cpp begins */
 
 // Check that the relative error between the price and the effective price does
@@ -757,4 +796,180 @@ ExchangeResultV10 applyPriceErrorThresholds(Price price, int64_t wheatReceive, i
     return res;
 }
 
-} // namespace stellar
\ No newline at end of file
+// adjustOffer computes the amount of an offer that can actually be executed
+// when crossed by a buyer with no limits, i.e. it removes the part of the offer
+// that could never trade at its own price. The central property of adjustOffer
+// is that it has no effect when applied to an offer which has already been
+// adjusted (see the proof accompanying adjustOffer in vOfferExchange.cpp).
+int64_t
+adjustOffer(Price const& price, int64_t maxWheatSend, int64_t maxSheepReceive)
+{
+    // ZoneScoped;
+    auto res = exchangeV10(price, maxWheatSend, INT64_MAX, INT64_MAX,
+                           maxSheepReceive, RoundingType::NORMAL);
+    return res.numWheatReceived;
+}
+
+// Constant product exchange with a liquidity pool, from stellar-core. Pools are
+// only crossed by path payments, so only the two path payment roundings are
+// supported: for strict send the amount sent to the pool is fixed and the
+// amount received is rounded down, for strict receive the amount received is
+// fixed and the amount sent is rounded up. Returns false if the exchange is
+// impossible (the pool cannot pay out that much, or a reserve would overflow).
+bool
+exchangeWithPool(int64_t reservesToPool, int64_t maxSendToPool,
+                 int64_t& toPool, int64_t reservesFromPool,
+                 int64_t maxReceiveFromPool, int64_t& fromPool,
+                 int32_t feeInBps, RoundingType round)
+{
+    // ZoneScoped;
+    releaseAssertOrThrow(feeInBps >= 0 && feeInBps < MAX_BPS);
+    int32_t const maxBps = MAX_BPS;
+
+    if (round == RoundingType::PATH_PAYMENT_STRICT_SEND)
+    {
+        releaseAssertOrThrow(maxReceiveFromPool == INT64_MAX);
+        if (maxSendToPool > INT64_MAX - reservesToPool)
+        {
+            return false;
+        }
+        toPool = maxSendToPool;
+
+        // (maxBps - feeBps) * reservesFromPool * toPool
+        // ----------------------------------------------------
+        // maxBps * reservesToPool + (maxBps - feeBps) * toPool
+        uint128_t denominator = bigMultiply(maxBps, reservesToPool) +
+                                bigMultiply(maxBps - feeInBps, toPool);
+        return hugeDivide(fromPool, maxBps - feeInBps,
+                          bigMultiply(reservesFromPool, toPool), denominator,
+                          ROUND_DOWN);
+    }
+    else if (round == RoundingType::PATH_PAYMENT_STRICT_RECEIVE)
+    {
+        releaseAssertOrThrow(maxSendToPool == INT64_MAX);
+        if (maxReceiveFromPool >= reservesFromPool)
+        {
+            return false;
+        }
+        fromPool = maxReceiveFromPool;
+
+        //      maxBps * reservesToPool * fromPool
+        // -------------------------------------------------
+        // (maxBps - feeBps) * (reservesFromPool - fromPool)
+        uint128_t denominator =
+            bigMultiply(maxBps - feeInBps, reservesFromPool - fromPool);
+        return hugeDivide(toPool, maxBps, bigMultiply(reservesToPool, fromPool),
+                          denominator, ROUND_UP) &&
+               toPool <= INT64_MAX - reservesToPool;
+    }
+    else
+    {
+        throw std::runtime_error("Invalid rounding type");
+    }
+}
+
+bool
+operator==(Asset const& a, Asset const& b)
+{
+    return a.type == b.type && a.issuer == b.issuer &&
+           std::memcmp(a.code, b.code, sizeof(a.code)) == 0;
+}
+
+bool
+operator!=(Asset const& a, Asset const& b)
+{
+    return !(a == b);
+}
+
+bool
+operator<(Asset const& a, Asset const& b)
+{
+    if (a.type != b.type)
+    {
+        return a.type < b.type;
+    }
+    int c = std::memcmp(a.code, b.code, sizeof(a.code));
+    if (c != 0)
+    {
+        return c < 0;
+    }
+    return a.issuer < b.issuer;
+}
+
+Asset
+makeNativeAsset()
+{
+    Asset asset{};
+    asset.type = ASSET_TYPE_NATIVE;
+    return asset;
+}
+
+Asset
+makeAsset(std::string const& code, AccountID issuer)
+{
+    if (code.empty() || code.size() > sizeof(Asset::code) || issuer == 0)
+    {
+        throw std::runtime_error("invalid asset");
+    }
+    Asset asset{};
+    asset.type = code.size() <= 4 ? ASSET_TYPE_CREDIT_ALPHANUM4
+                                  : ASSET_TYPE_CREDIT_ALPHANUM12;
+    for (size_t i = 0; i < code.size(); ++i)
+    {
+        char c = code[i];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+              (c >= '0' && c <= '9')))
+        {
+            throw std::runtime_error("invalid asset");
+        }
+        asset.code[i] = c;
+    }
+    asset.issuer = issuer;
+    return asset;
+}
+
+static void
+putUint32(std::vector<uint8_t>& out, uint32_t v)
+{
+    for (int shift = 24; shift >= 0; shift -= 8)
+    {
+        out.push_back((uint8_t)(v >> shift));
+    }
+}
+
+static void
+putAsset(std::vector<uint8_t>& out, Asset const& asset)
+{
+    putUint32(out, (uint32_t)asset.type);
+    if (asset.type == ASSET_TYPE_NATIVE)
+    {
+        return;
+    }
+    size_t codeLen = asset.type == ASSET_TYPE_CREDIT_ALPHANUM4 ? 4 : 12;
+    out.insert(out.end(), asset.code, asset.code + codeLen);
+    putUint32(out, (uint32_t)(asset.issuer >> 32));
+    putUint32(out, (uint32_t)asset.issuer);
+}
+
+PoolID
+getPoolID(Asset const& x, Asset const& y, int32_t feeBps)
+{
+    if (x == y || feeBps < 0 || feeBps >= MAX_BPS)
+    {
+        throw std::runtime_error("invalid liquidity pool parameters");
+    }
+    Asset const& assetA = x < y ? x : y;
+    Asset const& assetB = x < y ? y : x;
+
+    // LiquidityPoolParameters: the LIQUIDITY_POOL_CONSTANT_PRODUCT arm (0)
+    // followed by assetA, assetB and the fee.
+    std::vector<uint8_t> xdr;
+    xdr.reserve(4 + 2 * 24 + 4);
+    putUint32(xdr, 0);
+    putAsset(xdr, assetA);
+    putAsset(xdr, assetB);
+    putUint32(xdr, (uint32_t)feeBps);
+    return sha256(xdr.data(), xdr.size());
+}
+
+} // namespace stellar
@@ -2,10 +2,12 @@
 #pragma once
 
 #include <functional>
+#include <string>
 #include <vector>
 #include <cstdint>
 
 #include "uint128_t.h"
+#include "SHA256.h"
 
 // This is a reference-and-orientation comment for people who, like myself, get
 // constantly mixed up when dealing with order-related code and concepts. If you
@@ -209,6 +211,9 @@ typedef unsigned long long uint64_t;
 typedef long long int64_t;
 #endif /* _INT64_T */
 
+void printAssertFailureAndAbort(const char* s1, const char* file, int line);
+void printAssertFailureAndThrow(const char* s1, const char* file, int line);
+
 // This is like `assert()` but it is _not_ sensitive to the presence of
 // NDEBUG. We don't compile with NDEBUG but "compiling out important asserts" is
 // enough of a footgun that we want to avoid even the possibility.
@@ -231,6 +236,40 @@ class LedgerTxnHeader;
 class TrustLineWrapper;
 class ConstTrustLineWrapper;
 
+// Accounts are identified by a dense 64-bit ID rather than a public key; the
+// in-memory order book never needs more than equality on them.
+typedef uint64_t AccountID;
+
+// Dense ID of an asset interned by a BookRegistry. IDs are handed out from 1,
+// so 0 can mean "no asset" and pair keys are never 0.
+typedef uint32_t AssetID;
+
+enum AssetType
+{
+    ASSET_TYPE_NATIVE = 0,
+    ASSET_TYPE_CREDIT_ALPHANUM4 = 1,
+    ASSET_TYPE_CREDIT_ALPHANUM12 = 2
+};
+
+// stellar's Asset union, flattened: the code is zero-padded, and both the code
+// and the issuer are zero for the native asset.
+struct Asset
+{
+    AssetType type;
+    char code[12];
+    AccountID issuer;
+};
+
+bool operator==(Asset const& a, Asset const& b);
+bool operator!=(Asset const& a, Asset const& b);
+// stellar's ordering: by type, then code, then issuer.
+bool operator<(Asset const& a, Asset const& b);
+
+Asset makeNativeAsset();
+// Alphanum4 for codes of up to 4 characters, alphanum12 for longer ones.
+// Throws unless code is 1 to 12 letters and digits and issuer is non-zero.
+Asset makeAsset(std::string const& code, AccountID issuer);
+
 enum Rounding
 {
     ROUND_DOWN,
@@ -297,24 +336,9 @@ uint128_t bigMultiply(int64_t a, int64_t b);
 // Compute a * B / C when C < INT32_MAX * INT64_MAX.
 bool hugeDivide(int64_t& result, int32_t a, uint128_t const& B, uint128_t const& C, Rounding rounding);
 
-// int64_t canSellAtMostBasedOnSheep(LedgerTxnHeader const& header,
-//                                   Asset const& sheep,
-//                                   ConstTrustLineWrapper const& sheepLine,
-//                                   Price const& wheatPrice);
-
-// int64_t canSellAtMost(LedgerTxnHeader const& header,
-//                       LedgerTxnEntry const& account, Asset const& asset,
-//                       TrustLineWrapper const& trustLine);
-// int64_t canSellAtMost(LedgerTxnHeader const& header,
-//                       ConstLedgerTxnEntry const& account, Asset const& asset,
-//                       ConstTrustLineWrapper const& trustLine);
-
-// int64_t canBuyAtMost(LedgerTxnHeader const& header,
-//                      LedgerTxnEntry const& account, Asset const& asset,
-//                      TrustLineWrapper const& trustLine);
-// int64_t canBuyAtMost(LedgerTxnHeader const& header,
-//                      ConstLedgerTxnEntry const& account, Asset const& asset,
-//                      ConstTrustLineWrapper const& trustLine);
+// canSellAtMost, canSellAtMostBasedOnSheep and canBuyAtMost read balances and
+// trustlines, which the in-memory exchange keeps in an AccountStore; they are
+// declared in AccountStore.h.
 
 ExchangeResult exchangeV2(int64_t wheatReceived, Price price,
                           int64_t maxWheatReceive, int64_t maxSheepSend);
@@ -337,6 +361,16 @@ int64_t adjustOffer(Price const& price, int64_t maxWheatSend,
 bool checkPriceErrorBound(Price price, int64_t wheatReceive, int64_t sheepSend,
                           bool canFavorWheat);
 
+// stellar-core's limit on the offers one operation may cross. Path search,
+// path quoting and arbitrage detection apply it per hop.
+int64_t const MAX_OFFERS_TO_CROSS = 1000;
+
+// Pool fees are expressed in basis points.
+int32_t const MAX_BPS = 10000;
+int32_t const LIQUIDITY_POOL_FEE_V18 = 30;
+
+typedef Hash PoolID;
+
 bool exchangeWithPool(int64_t reservesToPool, int64_t maxSendToPool,
                       int64_t& toPool, int64_t reservesFromPool,
                       int64_t maxReceiveFromPool, int64_t& fromPool,
@@ -374,7 +408,12 @@ enum class CrossOfferResult
 //     std::function<OfferFilterResult(LedgerTxnEntry const&)> filter,
 //     std::vector<ClaimAtom>& offerTrail, int64_t maxOffersToCross);
 
-// // Compute a PoolID as needed for offer exchange. Determines the correct order
-// // for x and y.
-// PoolID getPoolID(Asset const& x, Asset const& y, int32_t feeBps);
+// Compute a PoolID as needed for offer exchange. Determines the correct order
+// for x and y.
+//
+// Like stellar-core this is the SHA-256 of the XDR-encoded constant product
+// pool parameters (assetA < assetB, fee). Issuers here are 64-bit account IDs
+// rather than ed25519 keys, so the IDs are not the ones stellar computes for
+// the same assets. Throws if x == y or feeBps is not in [0, MAX_BPS).
+PoolID getPoolID(Asset const& x, Asset const& y, int32_t feeBps);
 }
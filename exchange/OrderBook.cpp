@@ -0,0 +1,1705 @@
+// In-memory order book driving the OfferExchange kernel, modelled on the
+// LedgerTxn-backed loop in stellar-core/src/transactions/OfferExchange.cpp
+
+#include "OrderBook.h"
+#include "AccountStore.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+
+namespace stellar
+{
+
+// Exact comparison of two prices by cross-multiplication. Both numerators and
+// denominators are positive int32_t, so the products cannot overflow int64_t.
+static int
+comparePrice(Price const& a, Price const& b)
+{
+    int64_t lhs = (int64_t)a.n * (int64_t)b.d;
+    int64_t rhs = (int64_t)b.n * (int64_t)a.d;
+    return (lhs < rhs) ? -1 : (lhs > rhs ? 1 : 0);
+}
+
+static void
+sellerCounters(AccountID seller, size_t mask, size_t& i1, size_t& i2)
+{
+    // splitmix64 finalizer: dense account IDs still spread over the counters.
+    uint64_t h = seller + 0x9E3779B97F4A7C15ull;
+    h = (h ^ (h >> 30)) * 0xBF58476D1CE4E5B9ull;
+    h = (h ^ (h >> 27)) * 0x94D049BB133111EBull;
+    h ^= h >> 31;
+    i1 = (size_t)h & mask;
+    i2 = (size_t)(h >> 32) & mask;
+}
+
+void
+SellerFilter::reset(size_t counters)
+{
+    size_t n = MIN_COUNTERS;
+    while (n < counters)
+    {
+        n *= 2;
+    }
+    mCounters.assign(n, 0);
+}
+
+void
+SellerFilter::add(AccountID seller)
+{
+    size_t i1, i2;
+    sellerCounters(seller, mCounters.size() - 1, i1, i2);
+    if (mCounters[i1] != UINT8_MAX)
+    {
+        ++mCounters[i1];
+    }
+    if (mCounters[i2] != UINT8_MAX)
+    {
+        ++mCounters[i2];
+    }
+}
+
+void
+SellerFilter::remove(AccountID seller)
+{
+    size_t i1, i2;
+    sellerCounters(seller, mCounters.size() - 1, i1, i2);
+    releaseAssertOrThrow(mCounters[i1] > 0 && mCounters[i2] > 0);
+    if (mCounters[i1] != UINT8_MAX)
+    {
+        --mCounters[i1];
+    }
+    if (mCounters[i2] != UINT8_MAX)
+    {
+        --mCounters[i2];
+    }
+}
+
+bool
+SellerFilter::mayContain(AccountID seller) const
+{
+    size_t i1, i2;
+    sellerCounters(seller, mCounters.size() - 1, i1, i2);
+    return mCounters[i1] != 0 && mCounters[i2] != 0;
+}
+
+OfferHandle const&
+OrderBook::findHandle(int64_t offerID) const
+{
+    auto handle = mIndex.find((uint64_t)offerID);
+    if (!handle)
+    {
+        throw std::runtime_error("offer not in book");
+    }
+    return *handle;
+}
+
+size_t
+OrderBook::orderPosition(Price const& price) const
+{
+    auto it = std::lower_bound(mOrder.begin(), mOrder.end(), price,
+                               [&](uint32_t level, Price const& p) {
+                                   return comparePrice(mLevels[level].price,
+                                                       p) < 0;
+                               });
+    return it - mOrder.begin();
+}
+
+uint32_t
+OrderBook::findOrCreateLevel(Price const& price)
+{
+    size_t pos = orderPosition(price);
+    if (pos < mOrder.size() &&
+        comparePrice(mLevels[mOrder[pos]].price, price) == 0)
+    {
+        return mOrder[pos];
+    }
+
+    uint32_t level;
+    if (!mFreeLevels.empty())
+    {
+        level = mFreeLevels.back();
+        mFreeLevels.pop_back();
+    }
+    else
+    {
+        level = (uint32_t)mLevels.size();
+        mLevels.emplace_back();
+    }
+    mLevels[level].price = price;
+    mOrder.insert(mOrder.begin() + pos, level);
+    mDepthTreeValid = false;
+    return level;
+}
+
+void
+OrderBook::addDepth(uint32_t level, int64_t delta)
+{
+    auto& pl = mLevels[level];
+    if (delta > 0 && mTotalDepth > INT64_MAX - delta)
+    {
+        throw std::overflow_error("overflow while aggregating depth");
+    }
+    pl.version = ++mVersionClock;
+    pl.depth += delta;
+    mTotalDepth += delta;
+    releaseAssertOrThrow(pl.depth >= 0);
+
+    if (mDepthTreeValid)
+    {
+        size_t n = mOrder.size();
+        for (size_t i = orderPosition(pl.price) + 1; i <= n; i += i & (~i + 1))
+        {
+            mDepthTree[i] += delta;
+        }
+    }
+}
+
+void
+OrderBook::rebuildDepthIndex() const
+{
+    size_t n = mOrder.size();
+    mDepthTree.assign(n + 1, 0);
+    for (size_t i = 1; i <= n; ++i)
+    {
+        mDepthTree[i] += mLevels[mOrder[i - 1]].depth;
+        size_t parent = i + (i & (~i + 1));
+        if (parent <= n)
+        {
+            mDepthTree[parent] += mDepthTree[i];
+        }
+    }
+    mDepthTreeValid = true;
+}
+
+int64_t
+OrderBook::depthAtOrBelow(Price const& limit) const
+{
+    if (!mDepthTreeValid)
+    {
+        rebuildDepthIndex();
+    }
+    auto it = std::upper_bound(mOrder.begin(), mOrder.end(), limit,
+                               [&](Price const& p, uint32_t level) {
+                                   return comparePrice(p, mLevels[level].price) <
+                                          0;
+                               });
+    int64_t sum = 0;
+    for (size_t i = it - mOrder.begin(); i > 0; i -= i & (~i + 1))
+    {
+        sum += mDepthTree[i];
+    }
+    return sum;
+}
+
+int64_t
+OrderBook::maxWheatForSheep(int64_t sheep) const
+{
+    int64_t bound = walkLevelsForSheep(sheep, false);
+    if (mExpiries.size() == 0)
+    {
+        bound = std::min(bound, walkLevelsForSheep(sheep, true));
+    }
+    return bound;
+}
+
+// Taking an offer whole rounds in the taker's favour by less than one unit of
+// wheat, and by no more than 1% of the price; an offer left in the book is
+// never rounded in the taker's favour (exchangeV10WithoutPriceErrorThresholds
+// and applyPriceErrorThresholds). perOffer walks at the exact prices with one
+// unit per offer taken, otherwise the prices lose the 1%. Expired offers still
+// counted in a level would let the per-offer walk stop short of where the
+// crossing, which skips them, really gets, so that one is only sound without
+// expiries; extra offers can only raise the 1% walk.
+int64_t
+OrderBook::walkLevelsForSheep(int64_t sheep, bool perOffer) const
+{
+    int64_t const num = perOffer ? 1 : 99;
+    int64_t const den = perOffer ? 1 : 100;
+    int64_t wheat = 0;
+    for (uint32_t level : mOrder)
+    {
+        auto const& pl = mLevels[level];
+        int64_t n = pl.price.n;
+        int64_t d = pl.price.d;
+        int64_t bonus = perOffer ? pl.live : 0;
+        int64_t cost;
+        if (bigDivide128(cost, bigMultiply(pl.depth - bonus, num * n), den * d,
+                         ROUND_DOWN) &&
+            cost < sheep)
+        {
+            wheat += pl.depth;
+            sheep -= cost;
+            continue;
+        }
+        int64_t rest;
+        if (!bigDivide128(rest, bigMultiply(sheep, den * d), num * n,
+                          ROUND_UP) ||
+            rest > pl.depth - bonus)
+        {
+            rest = pl.depth - bonus;
+        }
+        return wheat + rest + bonus;
+    }
+    return wheat;
+}
+
+bool
+OrderBook::priceToFill(int64_t amount, Price& price) const
+{
+    releaseAssertOrThrow(amount > 0);
+    if (amount > mTotalDepth)
+    {
+        return false;
+    }
+    if (!mDepthTreeValid)
+    {
+        rebuildDepthIndex();
+    }
+
+    // Descend the tree for the longest prefix whose sum is still < amount;
+    // the level right after it is the one that completes the fill.
+    size_t n = mOrder.size();
+    size_t step = 1;
+    while (step * 2 <= n)
+    {
+        step *= 2;
+    }
+    size_t pos = 0;
+    int64_t remaining = amount;
+    for (; step > 0; step /= 2)
+    {
+        if (pos + step <= n && mDepthTree[pos + step] < remaining)
+        {
+            pos += step;
+            remaining -= mDepthTree[pos];
+        }
+    }
+    price = mLevels[mOrder[pos]].price;
+    return true;
+}
+
+void
+OrderBook::addOffer(Offer const& offer, uint64_t expiresAt)
+{
+    if (offer.offerID <= 0 || offer.amount <= 0 || offer.price.n <= 0 ||
+        offer.price.d <= 0)
+    {
+        throw std::runtime_error("invalid offer");
+    }
+    if (mIndex.find((uint64_t)offer.offerID))
+    {
+        throw std::runtime_error("offer already in book");
+    }
+    if (mTotalDepth > INT64_MAX - offer.amount)
+    {
+        throw std::overflow_error("overflow while aggregating depth");
+    }
+    if (expiresAt != 0 && expiresAt <= mCloseTime)
+    {
+        throw std::runtime_error("offer already expired");
+    }
+
+    insertOffer(offer);
+    if (expiresAt != 0)
+    {
+        mExpiries.insert((uint64_t)offer.offerID, expiresAt);
+        mExpiryWheel.schedule((uint64_t)offer.offerID, expiresAt);
+    }
+    checkLiabilities();
+}
+
+void
+OrderBook::setCloseTime(uint64_t closeTime)
+{
+    releaseAssertOrThrow(closeTime >= mCloseTime);
+    if (closeTime != mCloseTime && mExpiries.size() != 0)
+    {
+        for (uint32_t level : mOrder)
+        {
+            mLevels[level].version = ++mVersionClock;
+        }
+    }
+    mCloseTime = closeTime;
+}
+
+bool
+OrderBook::isExpired(int64_t offerID) const
+{
+    if (mExpiries.size() == 0)
+    {
+        return false;
+    }
+    auto expiry = mExpiries.find((uint64_t)offerID);
+    return expiry && *expiry <= mCloseTime;
+}
+
+size_t
+OrderBook::expireOffers()
+{
+    mFired.clear();
+    mExpiryWheel.advance(mCloseTime, mFired);
+    size_t removed = 0;
+    for (uint64_t id : mFired)
+    {
+        // Offers removed since they were scheduled have left mExpiries.
+        if (isExpired((int64_t)id))
+        {
+            removeAt(findHandle((int64_t)id));
+            ++removed;
+        }
+    }
+    checkLiabilities();
+    return removed;
+}
+
+void
+OrderBook::expireBestOffers()
+{
+    while (!mOrder.empty())
+    {
+        auto const& pl = mLevels[mOrder.front()];
+        int64_t offerID = pl.offerIDs[pl.head];
+        if (!isExpired(offerID))
+        {
+            break;
+        }
+        removeAt(findHandle(offerID));
+    }
+    checkLiabilities();
+}
+
+void
+OrderBook::insertOffer(Offer const& offer)
+{
+    // Checked before the book changes; the update below cannot fail then.
+    checkLiabilityUpdate(offer.sellerID, offer.price, 0, offer.price,
+                         offer.amount);
+    updateLiabilities(offer.sellerID, offer.price, 0, offer.amount);
+    uint32_t level = findOrCreateLevel(offer.price);
+    auto& pl = mLevels[level];
+    addDepth(level, offer.amount);
+
+    // Offers almost always arrive in ID order and go at the back. Otherwise
+    // the slots behind the new one shift, and so do their handles.
+    uint32_t slot = (uint32_t)pl.slots();
+    if (slot != 0 && pl.offerIDs.back() > offer.offerID)
+    {
+        auto it = std::lower_bound(pl.offerIDs.begin() + pl.head,
+                                   pl.offerIDs.end(), offer.offerID);
+        slot = (uint32_t)(it - pl.offerIDs.begin());
+        pl.amounts.insert(pl.amounts.begin() + slot, offer.amount);
+        pl.offerIDs.insert(it, offer.offerID);
+        pl.sellers.insert(pl.sellers.begin() + slot, offer.sellerID);
+        for (uint32_t s = slot + 1; s < pl.slots(); ++s)
+        {
+            if (pl.amounts[s] != 0)
+            {
+                mIndex.find((uint64_t)pl.offerIDs[s])->slot = s;
+            }
+        }
+    }
+    else
+    {
+        pl.amounts.push_back(offer.amount);
+        pl.offerIDs.push_back(offer.offerID);
+        pl.sellers.push_back(offer.sellerID);
+    }
+    ++pl.live;
+    mIndex.insert((uint64_t)offer.offerID, OfferHandle{level, slot});
+    if (mIndex.size() * 4 > mSellers.numCounters())
+    {
+        rebuildSellerFilter();
+    }
+    else
+    {
+        mSellers.add(offer.sellerID);
+    }
+    publishLevel(level, pl.live == 1 ? MarketDataEventType::LEVEL_ADD
+                                     : MarketDataEventType::LEVEL_MODIFY);
+}
+
+// Crossing order: price, then arrival (offer IDs are allocated sequentially).
+static bool
+offerPrecedes(Offer const& a, Offer const& b)
+{
+    int c = comparePrice(a.price, b.price);
+    return c < 0 || (c == 0 && a.offerID < b.offerID);
+}
+
+// Sorts each of `chunks` runs on its own thread, then merges neighbouring runs
+// pairwise, again one thread per merge, until one run is left.
+static void
+parallelSort(std::vector<Offer>& offers, size_t chunks)
+{
+    size_t const n = offers.size();
+    std::vector<size_t> bounds;
+    for (size_t i = 0; i <= chunks; ++i)
+    {
+        bounds.push_back(n * i / chunks);
+    }
+
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i + 1 < bounds.size(); ++i)
+    {
+        workers.emplace_back([&offers, &bounds, i]() {
+            std::sort(offers.begin() + bounds[i], offers.begin() + bounds[i + 1],
+                      offerPrecedes);
+        });
+    }
+    for (auto& w : workers)
+    {
+        w.join();
+    }
+
+    while (bounds.size() > 2)
+    {
+        std::vector<size_t> merged;
+        workers.clear();
+        size_t i = 0;
+        for (; i + 2 < bounds.size(); i += 2)
+        {
+            workers.emplace_back([&offers, &bounds, i]() {
+                std::inplace_merge(offers.begin() + bounds[i],
+                                   offers.begin() + bounds[i + 1],
+                                   offers.begin() + bounds[i + 2],
+                                   offerPrecedes);
+            });
+            merged.push_back(bounds[i]);
+        }
+        for (; i < bounds.size(); ++i)
+        {
+            merged.push_back(bounds[i]);
+        }
+        for (auto& w : workers)
+        {
+            w.join();
+        }
+        bounds.swap(merged);
+    }
+}
+
+void
+OrderBook::reset()
+{
+    MarketDataFeed* feed = mFeed;
+    AccountStore* accounts = mAccounts;
+    AssetID wheat = mWheat;
+    AssetID sheep = mSheep;
+    uint64_t closeTime = mCloseTime;
+    uint64_t versionClock = mVersionClock;
+    *this = OrderBook();
+    mFeed = feed;
+    mAccounts = accounts;
+    mWheat = wheat;
+    mSheep = sheep;
+    mCloseTime = closeTime;
+    mVersionClock = versionClock;
+}
+
+void
+OrderBook::bulkLoad(std::vector<Offer> offers, unsigned threads)
+{
+    // Below this many offers per thread, starting threads costs more than the
+    // sort saves.
+    size_t const MIN_OFFERS_PER_THREAD = 1 << 16;
+
+    if (size() != 0)
+    {
+        throw std::runtime_error("bulk load into a non-empty book");
+    }
+    for (auto const& offer : offers)
+    {
+        if (offer.offerID <= 0 || offer.amount <= 0 || offer.price.n <= 0 ||
+            offer.price.d <= 0)
+        {
+            throw std::runtime_error("invalid offer");
+        }
+    }
+
+    if (threads == 0)
+    {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    size_t chunks = std::min<size_t>(
+        threads, std::max<size_t>(1, offers.size() / MIN_OFFERS_PER_THREAD));
+    if (chunks > 1)
+    {
+        parallelSort(offers, chunks);
+    }
+    else
+    {
+        std::sort(offers.begin(), offers.end(), offerPrecedes);
+    }
+
+    reset();
+    mIndex.reserve(offers.size());
+    mSellers.reset(offers.size() * 8);
+    for (size_t i = 0; i < offers.size(); ++i)
+    {
+        auto const& offer = offers[i];
+        if (mTotalDepth > INT64_MAX - offer.amount)
+        {
+            reset();
+            throw std::overflow_error("overflow while aggregating depth");
+        }
+        if (i == 0 || comparePrice(offers[i - 1].price, offer.price) != 0)
+        {
+            size_t end = i + 1;
+            while (end < offers.size() &&
+                   comparePrice(offers[end].price, offer.price) == 0)
+            {
+                ++end;
+            }
+            mOrder.push_back((uint32_t)mLevels.size());
+            mLevels.emplace_back();
+            auto& pl = mLevels.back();
+            pl.price = offer.price;
+            pl.version = ++mVersionClock;
+            pl.amounts.reserve(end - i);
+            pl.offerIDs.reserve(end - i);
+            pl.sellers.reserve(end - i);
+        }
+        auto& pl = mLevels.back();
+        if (!mIndex.insert((uint64_t)offer.offerID,
+                           OfferHandle{mOrder.back(), (uint32_t)pl.slots()}))
+        {
+            reset();
+            throw std::runtime_error("offer already in book");
+        }
+        pl.amounts.push_back(offer.amount);
+        pl.offerIDs.push_back(offer.offerID);
+        pl.sellers.push_back(offer.sellerID);
+        pl.depth += offer.amount;
+        ++pl.live;
+        mTotalDepth += offer.amount;
+        mSellers.add(offer.sellerID);
+    }
+
+    for (uint32_t level : mOrder)
+    {
+        publishLevel(level, MarketDataEventType::LEVEL_ADD);
+    }
+    if (mAccounts)
+    {
+        for (auto const& offer : offers)
+        {
+            updateLiabilities(offer.sellerID, offer.price, 0, offer.amount);
+        }
+        checkLiabilities();
+    }
+}
+
+void
+OrderBook::rebuildSellerFilter()
+{
+    mSellers.reset(mIndex.size() * 8);
+    for (uint32_t level : mOrder)
+    {
+        auto const& pl = mLevels[level];
+        for (size_t slot = pl.head; slot < pl.slots(); ++slot)
+        {
+            if (pl.amounts[slot] != 0)
+            {
+                mSellers.add(pl.sellers[slot]);
+            }
+        }
+    }
+}
+
+void
+OrderBook::publishLevel(uint32_t level, MarketDataEventType type) const
+{
+    if (mFeed)
+    {
+        auto const& pl = mLevels[level];
+        mFeed->publish(type, pl.price, pl.depth, pl.live);
+    }
+}
+
+void
+OrderBook::setAccountStore(AccountStore* store, AssetID wheat, AssetID sheep)
+{
+    forEachOffer([&](Offer const& offer) {
+        updateLiabilities(offer.sellerID, offer.price, offer.amount, 0);
+    });
+    mAccounts = store;
+    mWheat = wheat;
+    mSheep = sheep;
+    forEachOffer([&](Offer const& offer) {
+        updateLiabilities(offer.sellerID, offer.price, 0, offer.amount);
+    });
+    checkLiabilities();
+}
+
+void
+OrderBook::updateLiabilities(AccountID seller, Price const& price,
+                             int64_t oldAmount, int64_t newAmount)
+{
+    if (mAccounts)
+    {
+        mAccounts->updateOfferLiabilities(seller, mWheat, mSheep, price,
+                                          oldAmount, newAmount);
+    }
+}
+
+// Throws, before anything changes, if an offer's liabilities cannot move as
+// the change about to be made needs.
+void
+OrderBook::checkLiabilityUpdate(AccountID seller, Price const& oldPrice,
+                                int64_t oldAmount, Price const& newPrice,
+                                int64_t newAmount) const
+{
+    if (mAccounts)
+    {
+        mAccounts->checkOfferLiabilities(seller, mWheat, mSheep, oldPrice,
+                                         oldAmount, newPrice, newAmount);
+    }
+}
+
+void
+OrderBook::checkLiabilities() const
+{
+    if (mAccounts && mAccounts->checkingLiabilities())
+    {
+        mAccounts->checkLiabilities();
+    }
+}
+
+void
+OrderBook::removeAt(OfferHandle handle)
+{
+    auto& pl = mLevels[handle.level];
+    updateLiabilities(pl.sellers[handle.slot], pl.price,
+                      pl.amounts[handle.slot], 0);
+    mIndex.erase((uint64_t)pl.offerIDs[handle.slot]);
+    if (mExpiries.size() != 0)
+    {
+        mExpiries.erase((uint64_t)pl.offerIDs[handle.slot]);
+    }
+    mSellers.remove(pl.sellers[handle.slot]);
+    addDepth(handle.level, -pl.amounts[handle.slot]);
+    pl.amounts[handle.slot] = 0;
+
+    if (--pl.live == 0)
+    {
+        dropLevel(handle.level);
+        return;
+    }
+    int64_t const* amounts = pl.amounts.data();
+    while (amounts[pl.head] == 0)
+    {
+        ++pl.head;
+    }
+    publishLevel(handle.level, MarketDataEventType::LEVEL_MODIFY);
+}
+
+// Returns a level whose last offer is gone to the pool.
+void
+OrderBook::dropLevel(uint32_t level)
+{
+    auto& pl = mLevels[level];
+    publishLevel(level, MarketDataEventType::LEVEL_DELETE);
+    mOrder.erase(mOrder.begin() + orderPosition(pl.price));
+    mDepthTreeValid = false;
+    pl.amounts.clear();
+    pl.offerIDs.clear();
+    pl.sellers.clear();
+    pl.head = 0;
+    mFreeLevels.push_back(level);
+}
+
+bool
+OrderBook::bestLevelSlots(LevelSlots& slots) const
+{
+    if (mOrder.empty())
+    {
+        return false;
+    }
+    auto const& pl = mLevels[mOrder.front()];
+    slots = LevelSlots{pl.price, pl.amounts.data() + pl.head,
+                       pl.offerIDs.data() + pl.head,
+                       pl.sellers.data() + pl.head, pl.slots() - pl.head};
+    return true;
+}
+
+void
+OrderBook::takeBestOffers(size_t count)
+{
+    releaseAssertOrThrow(!mOrder.empty() && mExpiries.size() == 0);
+    uint32_t level = mOrder.front();
+    auto& pl = mLevels[level];
+    releaseAssertOrThrow(count <= pl.live);
+
+    int64_t removed = 0;
+    uint32_t slot = pl.head;
+    for (size_t taken = 0; taken < count; ++slot)
+    {
+        int64_t amount = pl.amounts[slot];
+        if (amount == 0)
+        {
+            continue;
+        }
+        updateLiabilities(pl.sellers[slot], pl.price, amount, 0);
+        mIndex.erase((uint64_t)pl.offerIDs[slot]);
+        mSellers.remove(pl.sellers[slot]);
+        pl.amounts[slot] = 0;
+        removed += amount;
+        ++taken;
+    }
+    addDepth(level, -removed);
+    pl.live -= (uint32_t)count;
+
+    if (pl.live == 0)
+    {
+        dropLevel(level);
+    }
+    else
+    {
+        int64_t const* amounts = pl.amounts.data();
+        while (amounts[pl.head] == 0)
+        {
+            ++pl.head;
+        }
+        publishLevel(level, MarketDataEventType::LEVEL_MODIFY);
+    }
+    checkLiabilities();
+}
+
+bool
+OrderBook::eraseOffer(int64_t offerID)
+{
+    auto handle = mIndex.find((uint64_t)offerID);
+    if (!handle)
+    {
+        return false;
+    }
+    removeAt(*handle);
+    checkLiabilities();
+    return true;
+}
+
+void
+OrderBook::setOfferAmount(int64_t offerID, int64_t amount)
+{
+    releaseAssertOrThrow(amount >= 0);
+    OfferHandle handle = findHandle(offerID);
+    if (amount == 0)
+    {
+        removeAt(handle);
+    }
+    else
+    {
+        auto& pl = mLevels[handle.level];
+        // Both checks come before anything changes: the liabilities here,
+        // the depth in addDepth.
+        checkLiabilityUpdate(pl.sellers[handle.slot], pl.price,
+                             pl.amounts[handle.slot], pl.price, amount);
+        addDepth(handle.level, amount - pl.amounts[handle.slot]);
+        updateLiabilities(pl.sellers[handle.slot], pl.price,
+                          pl.amounts[handle.slot], amount);
+        pl.amounts[handle.slot] = amount;
+        publishLevel(handle.level, MarketDataEventType::LEVEL_MODIFY);
+    }
+    checkLiabilities();
+}
+
+bool
+OrderBook::amendOffer(int64_t offerID, int64_t amount, Price const& price)
+{
+    if (amount < 0 || price.n <= 0 || price.d <= 0)
+    {
+        throw std::runtime_error("invalid offer");
+    }
+    auto found = mIndex.find((uint64_t)offerID);
+    if (!found)
+    {
+        return false;
+    }
+    OfferHandle handle = *found;
+    auto& pl = mLevels[handle.level];
+    int64_t delta = amount - pl.amounts[handle.slot];
+
+    if (amount == 0)
+    {
+        removeAt(handle);
+    }
+    else if (comparePrice(pl.price, price) == 0)
+    {
+        // Both checks come before anything changes: the liabilities here,
+        // the depth in addDepth.
+        checkLiabilityUpdate(pl.sellers[handle.slot], pl.price,
+                             pl.amounts[handle.slot], price, amount);
+        addDepth(handle.level, delta);
+        updateLiabilities(pl.sellers[handle.slot], pl.price,
+                          pl.amounts[handle.slot], amount);
+        pl.amounts[handle.slot] = amount;
+        publishLevel(handle.level, MarketDataEventType::LEVEL_MODIFY);
+    }
+    else
+    {
+        if (delta > 0 && mTotalDepth > INT64_MAX - delta)
+        {
+            throw std::overflow_error("overflow while aggregating depth");
+        }
+        // The offer leaves its level before it is inserted again, so the
+        // liabilities are checked for the whole move first.
+        checkLiabilityUpdate(pl.sellers[handle.slot], pl.price,
+                             pl.amounts[handle.slot], price, amount);
+        Offer moved{pl.sellers[handle.slot], offerID, amount, price};
+        // The wheel entry stays valid as long as the expiry is restored.
+        auto expiry = mExpiries.find((uint64_t)offerID);
+        uint64_t expiresAt = expiry ? *expiry : 0;
+        removeAt(handle);
+        insertOffer(moved);
+        if (expiresAt != 0)
+        {
+            mExpiries.insert((uint64_t)offerID, expiresAt);
+        }
+    }
+    checkLiabilities();
+    return true;
+}
+
+bool
+OrderBook::loadOffer(int64_t offerID, Offer& offer) const
+{
+    auto handle = mIndex.find((uint64_t)offerID);
+    if (!handle)
+    {
+        return false;
+    }
+    offer = mLevels[handle->level].offerAt(handle->slot);
+    return true;
+}
+
+bool
+OrderBook::loadBestOffer(Offer& offer) const
+{
+    if (mOrder.empty())
+    {
+        return false;
+    }
+    if (mExpiries.size() != 0)
+    {
+        Cursor cursor(*this);
+        return cursor.next(offer);
+    }
+    auto const& pl = mLevels[mOrder.front()];
+    offer = pl.offerAt(pl.head);
+    return true;
+}
+
+bool
+OrderBook::Cursor::next(Offer& offer)
+{
+    while (mPos < mBook.mOrder.size())
+    {
+        auto const& pl = mBook.mLevels[mBook.mOrder[mPos]];
+        if (!mInLevel)
+        {
+            mSlot = pl.head;
+            mInLevel = true;
+        }
+        for (; mSlot < pl.slots(); ++mSlot)
+        {
+            if (pl.amounts[mSlot] != 0 &&
+                !mBook.isExpired(pl.offerIDs[mSlot]))
+            {
+                offer = pl.offerAt(mSlot++);
+                return true;
+            }
+        }
+        ++mPos;
+        mInLevel = false;
+    }
+    return false;
+}
+
+size_t
+OrderBook::Cursor::skip(size_t count)
+{
+    size_t skipped = 0;
+    if (mBook.mExpiries.size() == 0)
+    {
+        while (!mInLevel && mPos < mBook.mOrder.size())
+        {
+            auto const& pl = mBook.mLevels[mBook.mOrder[mPos]];
+            if (skipped + pl.live > count)
+            {
+                break;
+            }
+            skipped += pl.live;
+            ++mPos;
+        }
+    }
+    Offer offer;
+    while (skipped < count && next(offer))
+    {
+        ++skipped;
+    }
+    return skipped;
+}
+
+void
+OrderBook::getDepth(std::vector<DepthLevel>& levels, size_t maxLevels) const
+{
+    levels.clear();
+    size_t n = std::min(maxLevels, mOrder.size());
+    for (size_t i = 0; i < n; ++i)
+    {
+        auto const& pl = mLevels[mOrder[i]];
+        levels.push_back(DepthLevel{pl.price, pl.depth, pl.live});
+    }
+}
+
+size_t
+OrderBook::levelsAtOrBelow(Price const& price) const
+{
+    size_t pos = orderPosition(price);
+    if (pos < mOrder.size() &&
+        comparePrice(mLevels[mOrder[pos]].price, price) == 0)
+    {
+        ++pos;
+    }
+    return pos;
+}
+
+void
+OrderBook::stampTopLevels(size_t levels, std::vector<LevelStamp>& stamps) const
+{
+    size_t n = std::min(levels, mOrder.size());
+    for (size_t i = 0; i < n; ++i)
+    {
+        stamps.push_back(LevelStamp{mOrder[i], mLevels[mOrder[i]].version});
+    }
+}
+
+bool
+OrderBook::topLevelsUnchanged(LevelStamp const* stamps, size_t count,
+                              bool wholeBook) const
+{
+    if (count > mOrder.size() || (wholeBook && count != mOrder.size()))
+    {
+        return false;
+    }
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (mOrder[i] != stamps[i].level ||
+            mLevels[mOrder[i]].version != stamps[i].version)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Repacks one level if it holds tombstones or more than twice the capacity
+// its slots need, returning the bytes released.
+size_t
+OrderBook::compactLevel(uint32_t level)
+{
+    auto& pl = mLevels[level];
+    size_t before = pl.bytes();
+    if (pl.live == pl.slots() && pl.amounts.capacity() <= 2 * pl.slots())
+    {
+        return 0;
+    }
+
+    std::vector<int64_t> amounts;
+    std::vector<int64_t> offerIDs;
+    std::vector<AccountID> sellers;
+    amounts.reserve(pl.live);
+    offerIDs.reserve(pl.live);
+    sellers.reserve(pl.live);
+    for (size_t slot = pl.head; slot < pl.slots(); ++slot)
+    {
+        if (pl.amounts[slot] == 0)
+        {
+            continue;
+        }
+        if (slot != amounts.size())
+        {
+            mIndex.find((uint64_t)pl.offerIDs[slot])->slot =
+                (uint32_t)amounts.size();
+        }
+        amounts.push_back(pl.amounts[slot]);
+        offerIDs.push_back(pl.offerIDs[slot]);
+        sellers.push_back(pl.sellers[slot]);
+    }
+    pl.amounts.swap(amounts);
+    pl.offerIDs.swap(offerIDs);
+    pl.sellers.swap(sellers);
+    pl.head = 0;
+    return before - pl.bytes();
+}
+
+size_t
+OrderBook::compact(size_t budget)
+{
+    size_t reclaimed = 0;
+    size_t work = 0;
+    for (size_t visited = 0; visited < mLevels.size(); ++visited)
+    {
+        if (mCompactNext >= mLevels.size())
+        {
+            mCompactNext = 0;
+        }
+        auto& pl = mLevels[mCompactNext];
+        size_t cost = pl.slots() + 1;
+        if (work != 0 && work + cost > budget)
+        {
+            break;
+        }
+        work += cost;
+        if (pl.live == 0)
+        {
+            // A free level keeps the capacity of the level it used to be.
+            reclaimed += pl.bytes();
+            std::vector<int64_t>().swap(pl.amounts);
+            std::vector<int64_t>().swap(pl.offerIDs);
+            std::vector<AccountID>().swap(pl.sellers);
+        }
+        else
+        {
+            reclaimed += compactLevel(mCompactNext);
+        }
+        ++mCompactNext;
+    }
+    return reclaimed;
+}
+
+size_t
+OrderBook::memoryUsage() const
+{
+    size_t bytes =
+        mLevels.capacity() * sizeof(PriceLevel) +
+        (mFreeLevels.capacity() + mOrder.capacity()) * sizeof(uint32_t) +
+        mIndex.capacity() * sizeof(FlatHashMap64<OfferHandle>::Slot) +
+        mExpiries.capacity() * sizeof(FlatHashMap64<uint64_t>::Slot) +
+        mExpiryWheel.memoryUsage();
+    for (auto const& pl : mLevels)
+    {
+        bytes += pl.bytes();
+    }
+    return bytes;
+}
+
+static Offer
+invertOffer(Offer offer)
+{
+    offer.price = Price{offer.price.d, offer.price.n};
+    return offer;
+}
+
+DepthLevel
+InvertedBookView::level(size_t i) const
+{
+    releaseAssertOrThrow(i < mBook.mOrder.size());
+    auto const& pl = mBook.mLevels[mBook.mOrder[mBook.mOrder.size() - 1 - i]];
+    return DepthLevel{Price{pl.price.d, pl.price.n}, pl.depth, pl.live};
+}
+
+bool
+InvertedBookView::loadOffer(int64_t offerID, Offer& offer) const
+{
+    if (!mBook.loadOffer(offerID, offer))
+    {
+        return false;
+    }
+    offer = invertOffer(offer);
+    return true;
+}
+
+bool
+InvertedBookView::loadBestOffer(Offer& offer) const
+{
+    if (!mBook.loadBestOffer(offer))
+    {
+        return false;
+    }
+    offer = invertOffer(offer);
+    return true;
+}
+
+std::function<OfferFilterResult(Offer const&)>
+makeOfferFilter(InvertedBookView const& view, AccountID taker,
+                Price const& minWheatPrice, bool passive)
+{
+    int64_t const stopAtEqual = passive ? 1 : 0;
+    bool const selfCheck = view.book().mayHaveOffersFrom(taker);
+    return [=](Offer const& o) {
+        if (comparePrice(minWheatPrice, o.price) + stopAtEqual > 0)
+        {
+            return OfferFilterResult::eStopBadPrice;
+        }
+        if (selfCheck && o.sellerID == taker)
+        {
+            return OfferFilterResult::eStopCrossSelf;
+        }
+        return OfferFilterResult::eKeep;
+    };
+}
+
+std::function<OfferFilterResult(Offer const&)>
+makeOfferFilter(OrderBook const& book, AccountID taker,
+                Price const& maxWheatPrice, bool passive)
+{
+    int64_t const stopAtEqual = passive ? 1 : 0;
+    if (!book.mayHaveOffersFrom(taker))
+    {
+        return [=](Offer const& o) {
+            if (comparePrice(o.price, maxWheatPrice) + stopAtEqual > 0)
+            {
+                return OfferFilterResult::eStopBadPrice;
+            }
+            return OfferFilterResult::eKeep;
+        };
+    }
+    return [=](Offer const& o) {
+        if (comparePrice(o.price, maxWheatPrice) + stopAtEqual > 0)
+        {
+            return OfferFilterResult::eStopBadPrice;
+        }
+        if (o.sellerID == taker)
+        {
+            return OfferFilterResult::eStopCrossSelf;
+        }
+        return OfferFilterResult::eKeep;
+    };
+}
+
+namespace
+{
+// The crossing loop runs against one of two sources of offers. LiveBook is the
+// book itself: fills are applied and published as they happen. QuotedBook
+// walks a book without modifying it, which is all a quote needs: every offer
+// the loop crosses is taken whole except possibly the last, and the loop stops
+// after a partial fill. The claim atoms of a quote plus the remaining amount of
+// the last offer are therefore enough to apply it later (see commitQuote).
+class LiveBook
+{
+  public:
+    explicit LiveBook(OrderBook& book) : mBook(book)
+    {
+    }
+
+    bool
+    loadBestOffer(Offer& offer)
+    {
+        mBook.expireBestOffers();
+        return mBook.loadBestOffer(offer);
+    }
+
+    void
+    fill(Offer const& offer, int64_t numWheatReceived, int64_t numSheepSend,
+         int64_t newAmount)
+    {
+        // The trade goes out ahead of the level update it causes.
+        if (auto feed = mBook.marketDataFeed())
+        {
+            feed->publish(MarketDataEventType::TRADE, offer.price,
+                          numWheatReceived, numSheepSend, offer.offerID,
+                          offer.sellerID);
+        }
+        mBook.setOfferAmount(offer.offerID, newAmount);
+    }
+
+    // Level sweep: takes the run of offers at the top of the best level that
+    // the crossing loop would take whole, one after the other, and removes
+    // them from the book in one step. Returns how many it took; the loop
+    // deals with the offer that ends the run.
+    //
+    // An offer the loop takes whole trades its adjusted amount a for
+    // floor(a * n / d) sheep, whatever the rounding mode: that is the
+    // !wheatStays branch of exchangeV10, and the price error check it then
+    // runs is the one adjustOffer already passed. So the sweep works out each
+    // offer's trade from that closed form and accumulates the running sums of
+    // wheat and sheep, which say where the run ends: at the first offer that
+    // would not be taken whole (more than the wheat or sheep still wanted),
+    // that the filter stops, that is not already adjusted, or that would go
+    // over maxOffersToCross. Every claim atom is the one the loop would
+    // record. What the sweep saves is the rest of the loop's per offer work:
+    // adjustOffer, exchangeV10, finding the best offer again and removing it
+    // from its level, aggregate, depth index and feed one at a time.
+    size_t
+    sweepLevel(int64_t maxSheepSend, int64_t& sheepSend,
+               int64_t maxWheatReceive, int64_t& wheatReceived,
+               std::function<OfferFilterResult(Offer const&)> const& filter,
+               std::vector<ClaimAtom>& offerTrail, int64_t maxOffersToCross)
+    {
+        LevelSlots slots;
+        if (mBook.hasExpiringOffers() || !mBook.bestLevelSlots(slots))
+        {
+            return 0;
+        }
+        Price const price = slots.price;
+        uint128_t const maxWheatValue = bigMultiply(INT64_MAX, price.d);
+        size_t const trailStart = offerTrail.size();
+        int64_t wheat = wheatReceived;
+        int64_t sheep = sheepSend;
+        for (size_t i = 0; i < slots.count; ++i)
+        {
+            int64_t amount = slots.amounts[i];
+            if (amount == 0)
+            {
+                continue;
+            }
+            if (sheep >= maxSheepSend || wheat >= maxWheatReceive ||
+                (int64_t)offerTrail.size() >= maxOffersToCross ||
+                amount > maxWheatReceive - wheat)
+            {
+                break;
+            }
+            uint128_t wheatValue = bigMultiply(amount, price.n);
+            if (wheatValue > maxWheatValue ||
+                wheatValue > bigMultiply(maxSheepSend - sheep, price.d))
+            {
+                break;
+            }
+            int64_t sheepForOffer;
+            bigDivide128(sheepForOffer, wheatValue, price.d, ROUND_DOWN);
+            if (!isAdjusted(price, amount, sheepForOffer))
+            {
+                break;
+            }
+            Offer offer{slots.sellers[i], slots.offerIDs[i], amount, price};
+            if (filter && filter(offer) != OfferFilterResult::eKeep)
+            {
+                break;
+            }
+            wheat += amount;
+            sheep += sheepForOffer;
+            offerTrail.push_back(ClaimAtom{offer.sellerID, offer.offerID,
+                                           amount, sheepForOffer});
+        }
+
+        size_t taken = offerTrail.size() - trailStart;
+        if (taken != 0)
+        {
+            // The trades go out ahead of the level update they cause.
+            if (auto feed = mBook.marketDataFeed())
+            {
+                for (size_t i = trailStart; i < offerTrail.size(); ++i)
+                {
+                    auto const& atom = offerTrail[i];
+                    feed->publish(MarketDataEventType::TRADE, price,
+                                  atom.amountSold, atom.amountBought,
+                                  atom.offerID, atom.sellerID);
+                }
+            }
+            mBook.takeBestOffers(taken);
+            wheatReceived = wheat;
+            sheepSend = sheep;
+        }
+        return taken;
+    }
+
+  private:
+    // Whether adjustOffer(price, amount, INT64_MAX) is amount, given that
+    // amount * price.n <= INT64_MAX * price.d and sheep = floor(amount *
+    // price.n / price.d): adjustOffer gives back the wheat for that much
+    // sheep, which is amount itself when wheat is the more valuable asset,
+    // and then applies the price error check.
+    static bool
+    isAdjusted(Price const& price, int64_t amount, int64_t sheep)
+    {
+        if (price.n <= price.d)
+        {
+            int64_t wheat;
+            if (sheep == 0 ||
+                !bigDivide128(wheat, bigMultiply(sheep, price.d), price.n,
+                              ROUND_UP) ||
+                wheat != amount)
+            {
+                return false;
+            }
+        }
+        return checkPriceErrorBound(price, amount, sheep, false);
+    }
+
+    OrderBook& mBook;
+};
+
+class QuotedBook
+{
+  public:
+    QuotedBook(OrderBook const& book, BookPosition const& from)
+        : mCursor(book), mPartial(from.partial)
+    {
+        mCursor.skip(from.taken);
+    }
+
+    bool
+    loadBestOffer(Offer& offer)
+    {
+        if (!mHaveOffer)
+        {
+            mHaveOffer = mCursor.next(mOffer);
+            if (mHaveOffer && mPartial != 0)
+            {
+                mOffer.amount = mPartial;
+                mPartial = 0;
+            }
+        }
+        offer = mOffer;
+        return mHaveOffer;
+    }
+
+    void
+    fill(Offer const&, int64_t, int64_t, int64_t newAmount)
+    {
+        mHaveOffer = false;
+        mLastAmount = newAmount;
+    }
+
+    // Quotes cross offer by offer.
+    size_t
+    sweepLevel(int64_t, int64_t&, int64_t, int64_t&,
+               std::function<OfferFilterResult(Offer const&)> const&,
+               std::vector<ClaimAtom>&, int64_t)
+    {
+        return 0;
+    }
+
+    // Moves position past the last `crossed` fills.
+    void
+    advance(BookPosition& position, size_t crossed, int64_t& lastAmount) const
+    {
+        if (crossed != 0)
+        {
+            lastAmount = mLastAmount;
+            position.taken += mLastAmount == 0 ? crossed : crossed - 1;
+            position.partial = mLastAmount;
+        }
+    }
+
+  private:
+    OrderBook::Cursor mCursor;
+    Offer mOffer;
+    bool mHaveOffer{false};
+    int64_t mPartial;
+    int64_t mLastAmount{0};
+};
+}
+
+void
+commitQuote(OrderBook& book, std::vector<ClaimAtom> const& offerTrail,
+            size_t first, size_t end, int64_t lastAmount)
+{
+    LiveBook live(book);
+    for (size_t i = first; i < end; ++i)
+    {
+        auto const& atom = offerTrail[i];
+        if (atom.offerID == 0)
+        {
+            continue;
+        }
+        Offer offer;
+        releaseAssertOrThrow(book.loadOffer(atom.offerID, offer));
+        live.fill(offer, atom.amountSold, atom.amountBought,
+                  i + 1 == end ? lastAmount : 0);
+    }
+}
+
+// In-memory counterpart of stellar-core's crossOfferV10. There are no balances
+// or trustlines in the book, so the offer is only limited by its own amount.
+template <typename Book>
+static CrossOfferResult
+crossOfferV10(Book& book, Offer const& offer, int64_t maxWheatReceived,
+              int64_t& numWheatReceived, int64_t maxSheepSend,
+              int64_t& numSheepSend, bool& wheatStays, RoundingType round,
+              std::vector<ClaimAtom>& offerTrail)
+{
+    // ZoneScoped;
+    releaseAssertOrThrow(maxWheatReceived > 0);
+    releaseAssertOrThrow(maxSheepSend > 0);
+
+    // As of the protocol version 10, this call to adjustOffer should have no
+    // effect. We leave it here only as a preventative measure.
+    int64_t amount = adjustOffer(offer.price, offer.amount, INT64_MAX);
+
+    auto exchangeResult = exchangeV10(offer.price, amount, maxWheatReceived,
+                                      maxSheepSend, INT64_MAX, round);
+
+    numWheatReceived = exchangeResult.numWheatReceived;
+    numSheepSend = exchangeResult.numSheepSend;
+    wheatStays = exchangeResult.wheatStays;
+
+    if (wheatStays)
+    {
+        amount = adjustOffer(offer.price, amount - numWheatReceived,
+                             INT64_MAX);
+    }
+    else
+    {
+        amount = 0;
+    }
+    book.fill(offer, numWheatReceived, numSheepSend, amount);
+
+    offerTrail.push_back(ClaimAtom{offer.sellerID, offer.offerID,
+                                   numWheatReceived, numSheepSend});
+    return (amount == 0) ? CrossOfferResult::eOfferTaken
+                         : CrossOfferResult::eOfferPartial;
+}
+
+template <typename Book>
+static ConvertResult
+crossWithOffers(Book& book, int64_t maxSheepSend, int64_t& sheepSend,
+                int64_t maxWheatReceive, int64_t& wheatReceived,
+                RoundingType round,
+                std::function<OfferFilterResult(Offer const&)> const& filter,
+                std::vector<ClaimAtom>& offerTrail, int64_t maxOffersToCross)
+{
+    // ZoneScoped;
+    sheepSend = 0;
+    wheatReceived = 0;
+
+    bool needMore = true;
+    while (needMore)
+    {
+        // Whole offers go a level at a time where the book allows it; the
+        // offer that ends a run is crossed below as usual.
+        while (book.sweepLevel(maxSheepSend, sheepSend, maxWheatReceive,
+                               wheatReceived, filter, offerTrail,
+                               maxOffersToCross) != 0)
+        {
+            needMore = sheepSend < maxSheepSend &&
+                       wheatReceived < maxWheatReceive;
+            if (!needMore)
+            {
+                return ConvertResult::eOK;
+            }
+        }
+
+        Offer wheatOffer;
+        if (!book.loadBestOffer(wheatOffer))
+        {
+            break;
+        }
+
+        if (filter)
+        {
+            switch (filter(wheatOffer))
+            {
+            case OfferFilterResult::eKeep:
+                break;
+            case OfferFilterResult::eStopBadPrice:
+                return ConvertResult::eFilterStopBadPrice;
+            case OfferFilterResult::eStopCrossSelf:
+                return ConvertResult::eFilterStopCrossSelf;
+            default:
+                throw std::runtime_error("unexpected filter result");
+            }
+        }
+
+        if ((int64_t)offerTrail.size() >= maxOffersToCross)
+        {
+            return ConvertResult::eCrossedTooMany;
+        }
+
+        int64_t numWheatReceived;
+        int64_t numSheepSend;
+        bool wheatStays;
+        CrossOfferResult cor = crossOfferV10(
+            book, wheatOffer, maxWheatReceive - wheatReceived,
+            numWheatReceived, maxSheepSend - sheepSend, numSheepSend,
+            wheatStays, round, offerTrail);
+
+        releaseAssertOrThrow(numSheepSend >= 0);
+        releaseAssertOrThrow(numSheepSend <= maxSheepSend - sheepSend);
+        releaseAssertOrThrow(numWheatReceived >= 0);
+        releaseAssertOrThrow(numWheatReceived <= maxWheatReceive - wheatReceived);
+        releaseAssertOrThrow(cor != CrossOfferResult::eOfferCantConvert);
+
+        sheepSend += numSheepSend;
+        wheatReceived += numWheatReceived;
+
+        needMore = !wheatStays && sheepSend < maxSheepSend &&
+                   wheatReceived < maxWheatReceive;
+    }
+    return needMore ? ConvertResult::ePartial : ConvertResult::eOK;
+}
+
+ConvertResult
+convertWithOffers(OrderBook& book, int64_t maxSheepSend, int64_t& sheepSend,
+                  int64_t maxWheatReceive, int64_t& wheatReceived,
+                  RoundingType round,
+                  std::function<OfferFilterResult(Offer const&)> filter,
+                  std::vector<ClaimAtom>& offerTrail, int64_t maxOffersToCross)
+{
+    LiveBook live(book);
+    return crossWithOffers(live, maxSheepSend, sheepSend, maxWheatReceive,
+                           wheatReceived, round, filter, offerTrail,
+                           maxOffersToCross);
+}
+
+ConvertResult
+quoteWithOffers(OrderBook const& book, BookPosition& position,
+                int64_t maxSheepSend, int64_t& sheepSend,
+                int64_t maxWheatReceive, int64_t& wheatReceived,
+                RoundingType round,
+                std::function<OfferFilterResult(Offer const&)> const& filter,
+                std::vector<ClaimAtom>& offerTrail, int64_t maxOffersToCross,
+                int64_t& lastAmount)
+{
+    QuotedBook quoted(book, position);
+    size_t trailSize = offerTrail.size();
+    auto res = crossWithOffers(quoted, maxSheepSend, sheepSend,
+                               maxWheatReceive, wheatReceived, round, filter,
+                               offerTrail, maxOffersToCross);
+    lastAmount = 0;
+    quoted.advance(position, offerTrail.size() - trailSize, lastAmount);
+    return res;
+}
+
+ConvertResult
+convertWithOffers(InvertedBookView& view, int64_t maxWheatSend,
+                  int64_t& wheatSend, int64_t maxSheepReceive,
+                  int64_t& sheepReceived, RoundingType round,
+                  std::function<OfferFilterResult(Offer const&)> filter,
+                  std::vector<ClaimAtom>& offerTrail, int64_t maxOffersToCross)
+{
+    std::function<OfferFilterResult(Offer const&)> bookFilter;
+    if (filter)
+    {
+        bookFilter = [&filter](Offer const& o) {
+            return filter(invertOffer(o));
+        };
+    }
+    return convertWithOffers(view.book(), maxWheatSend, wheatSend,
+                             maxSheepReceive, sheepReceived, round, bookFilter,
+                             offerTrail, maxOffersToCross);
+}
+
+ConvertResult
+quoteWithOffersAndPools(
+    OrderBook const& book, BookPosition& position, LiquidityPool* pool,
+    bool sheepIsA, int64_t maxSheepSend, int64_t& sheepSend,
+    int64_t maxWheatReceive, int64_t& wheatReceived, RoundingType round,
+    std::function<OfferFilterResult(Offer const&)> const& filter,
+    std::vector<ClaimAtom>& offerTrail, int64_t maxOffersToCross,
+    int64_t& lastAmount)
+{
+    // ZoneScoped;
+    int64_t sheepPool = 0;
+    int64_t wheatPool = 0;
+    bool poolSucceeded = false;
+    if (pool && round != RoundingType::NORMAL)
+    {
+        int64_t reservesToPool = sheepIsA ? pool->reserveA : pool->reserveB;
+        int64_t reservesFromPool = sheepIsA ? pool->reserveB : pool->reserveA;
+        poolSucceeded =
+            reservesToPool > 0 && reservesFromPool > 0 &&
+            exchangeWithPool(reservesToPool, maxSheepSend, sheepPool,
+                             reservesFromPool, maxWheatReceive, wheatPool,
+                             pool->feeBps, round) &&
+            sheepPool > 0 && wheatPool > 0;
+    }
+
+    // The book cannot give an eOK result if it would stop before crossing
+    // anything, and cannot beat a pool that is priced below the bound.
+    QuotedBook quoted(book, position);
+    Offer best;
+    bool bookStops = !quoted.loadBestOffer(best) ||
+                     (filter && filter(best) != OfferFilterResult::eKeep) ||
+                     (int64_t)offerTrail.size() >= maxOffersToCross;
+    bool quoteBook =
+        !poolSucceeded ||
+        (!bookStops && bigMultiply(sheepPool, 100 * (int64_t)best.price.d) >=
+                           bigMultiply(wheatPool, 99 * (int64_t)best.price.n));
+    if (quoteBook)
+    {
+        size_t trailSize = offerTrail.size();
+        auto res = crossWithOffers(quoted, maxSheepSend, sheepSend,
+                                   maxWheatReceive, wheatReceived, round,
+                                   filter, offerTrail, maxOffersToCross);
+        if (!poolSucceeded ||
+            (res == ConvertResult::eOK &&
+             bigMultiply(sheepPool, wheatReceived) >=
+                 bigMultiply(sheepSend, wheatPool)))
+        {
+            quoted.advance(position, offerTrail.size() - trailSize,
+                           lastAmount);
+            return res;
+        }
+        offerTrail.resize(trailSize);
+    }
+
+    (sheepIsA ? pool->reserveA : pool->reserveB) += sheepPool;
+    (sheepIsA ? pool->reserveB : pool->reserveA) -= wheatPool;
+    sheepSend = sheepPool;
+    wheatReceived = wheatPool;
+    offerTrail.push_back(ClaimAtom{0, 0, wheatPool, sheepPool});
+    return ConvertResult::eOK;
+}
+
+ConvertResult
+convertWithOffersAndPools(
+    OrderBook& book, LiquidityPool* pool, bool sheepIsA, int64_t maxSheepSend,
+    int64_t& sheepSend, int64_t maxWheatReceive, int64_t& wheatReceived,
+    RoundingType round, std::function<OfferFilterResult(Offer const&)> filter,
+    std::vector<ClaimAtom>& offerTrail, int64_t maxOffersToCross)
+{
+    // ZoneScoped;
+    if (!pool || round == RoundingType::NORMAL)
+    {
+        return convertWithOffers(book, maxSheepSend, sheepSend,
+                                 maxWheatReceive, wheatReceived, round, filter,
+                                 offerTrail, maxOffersToCross);
+    }
+
+    // The quote already is the result; it only has to be applied, so no
+    // offer goes through exchangeV10 twice.
+    size_t trailSize = offerTrail.size();
+    BookPosition position;
+    int64_t lastAmount = 0;
+    auto res = quoteWithOffersAndPools(
+        book, position, pool, sheepIsA, maxSheepSend, sheepSend,
+        maxWheatReceive, wheatReceived, round, filter, offerTrail,
+        maxOffersToCross, lastAmount);
+    commitQuote(book, offerTrail, trailSize, offerTrail.size(), lastAmount);
+    return res;
+}
+
+ConvertResult
+buyWithOffers(OrderBook& wheatBook, OrderBook& sheepBook, AccountID buyer,
+              int64_t offerID, int64_t buyAmount, Price const& price,
+              bool passive, int64_t maxSheepSend, int64_t& sheepSend,
+              int64_t& wheatReceived, int64_t& offerAmount,
+              std::vector<ClaimAtom>& offerTrail, int64_t maxOffersToCross)
+{
+    releaseAssertOrThrow(buyAmount > 0);
+    releaseAssertOrThrow(maxSheepSend > 0);
+    offerAmount = 0;
+
+    auto res = convertWithOffers(
+        wheatBook, maxSheepSend, sheepSend, buyAmount, wheatReceived,
+        RoundingType::NORMAL, makeOfferFilter(wheatBook, buyer, price, passive),
+        offerTrail, maxOffersToCross);
+
+    switch (res)
+    {
+    case ConvertResult::eOK:
+    case ConvertResult::ePartial:
+    case ConvertResult::eFilterStopBadPrice:
+        break;
+    default:
+        return res;
+    }
+
+    // The residue sells sheep for wheat, so its price is wheat/sheep.
+    Price sheepPrice{price.d, price.n};
+    int64_t sheepLeft = maxSheepSend - sheepSend;
+    int64_t wheatLeft = buyAmount - wheatReceived;
+    if (sheepLeft > 0 && wheatLeft > 0)
+    {
+        offerAmount = adjustOffer(sheepPrice, sheepLeft, wheatLeft);
+    }
+    if (offerAmount > 0)
+    {
+        sheepBook.addOffer(Offer{buyer, offerID, offerAmount, sheepPrice});
+    }
+    return res;
+}
+}
@@ -0,0 +1,646 @@
+// In-memory order book driving the OfferExchange kernel, modelled on the
+// LedgerTxn-backed loop in stellar-core/src/transactions/OfferExchange.cpp
+#pragma once
+
+#include <functional>
+#include <vector>
+#include <cstdint>
+
+#include "OfferExchange.h"
+#include "FlatHashMap.h"
+#include "MarketDataFeed.h"
+#include "TimerWheel.h"
+
+// An OrderBook holds the offers selling wheat for sheep for one wheat/sheep
+// pair: the bottom stack in the diagram in OfferExchange.h. Every offer price is
+// therefore sheep/wheat, and the best offer is the one with the _lowest_ price.
+//
+// Offers are grouped into price levels. Two prices that are equal as fractions
+// (1/2 and 2/4) share a level: exchangeV10 scales every product it forms by the
+// same factor for both representations, so they cross identically. Within a
+// level offers are kept in arrival order, which gives the same priority as
+// stellar-core's (price, offerID) ordering since offer IDs are allocated
+// sequentially.
+//
+// Every resting offer is addressed by an OfferHandle (level, slot), and an
+// open-addressing index maps offer IDs to handles. Cancelling or modifying an
+// offer is therefore a hash probe rather than a scan of the price levels.
+// Removing an offer leaves a tombstone in its slot instead of shifting the
+// offers behind it, so the handles of all other offers stay valid.
+
+namespace stellar
+{
+
+class AccountStore;
+
+// The fields of stellar's OfferEntry that matter for crossing, packed into 32
+// bytes. The assets are implied by the book the offer lives in. This is the
+// record the book hands out and takes in; inside a price level the fields are
+// stored column-wise (see PriceLevel).
+struct Offer
+{
+    AccountID sellerID;
+    int64_t offerID;
+    int64_t amount;
+    Price price;
+};
+static_assert(sizeof(Offer) == 32, "Offer must stay a 32-byte record");
+
+// Record of one crossed offer, as appended to the offer trail. A trade with a
+// liquidity pool is recorded with offerID and sellerID 0.
+struct ClaimAtom
+{
+    AccountID sellerID;
+    int64_t offerID;
+    int64_t amountSold;   // wheat, sold by the offer in the book
+    int64_t amountBought; // sheep, bought by the offer in the book
+};
+
+// Aggregated (L2) view of one price level.
+struct DepthLevel
+{
+    Price price;
+    int64_t amount; // total wheat offered at this price
+    uint32_t numOffers;
+};
+
+// Identifies the state of one price level of a book (see
+// OrderBook::stampTopLevels).
+struct LevelStamp
+{
+    uint32_t level;
+    uint64_t version;
+};
+
+// The slots of one price level as the level sweep of the crossing loop reads
+// them: parallel arrays starting at the first slot that may hold a live
+// offer, where amount 0 marks a removed one.
+struct LevelSlots
+{
+    Price price;
+    int64_t const* amounts;
+    int64_t const* offerIDs;
+    AccountID const* sellers;
+    size_t count;
+};
+
+struct OfferHandle
+{
+    uint32_t level;
+    uint32_t slot;
+};
+
+// Reserves of a constant product pool between two assets A and B. A pool
+// serves both directions of a pair, so the router is told which of its assets
+// is the sheep.
+struct LiquidityPool
+{
+    int64_t reserveA;
+    int64_t reserveB;
+    int32_t feeBps;
+};
+
+// Counting bloom filter over the sellers of the offers in a book. Each offer
+// adds one to two counters picked by hashing its seller, and removing the offer
+// takes them away again, so mayContain never has false negatives. Counters
+// saturate at 255 and then stay put, which can only make the answer
+// conservative.
+class SellerFilter
+{
+  public:
+    SellerFilter()
+    {
+        reset(MIN_COUNTERS);
+    }
+
+    // Clears the filter and resizes it to at least the given number of
+    // counters (rounded up to a power of two).
+    void reset(size_t counters);
+
+    size_t
+    numCounters() const
+    {
+        return mCounters.size();
+    }
+
+    void add(AccountID seller);
+    void remove(AccountID seller);
+    bool mayContain(AccountID seller) const;
+
+  private:
+    static size_t const MIN_COUNTERS = 1024;
+
+    std::vector<uint8_t> mCounters;
+};
+
+class OrderBook
+{
+  public:
+    // Adds an offer to its price level, behind every offer with a lower ID
+    // (which, with sequential IDs, is at the back). Throws if the offer is
+    // malformed or its ID is already in the book. An offer with a non-zero
+    // expiresAt expires once the close time reaches it; adding an offer that
+    // has already expired throws.
+    void addOffer(Offer const& offer, uint64_t expiresAt = 0);
+
+    // Offer expiry. Expired offers are never crossed and never reported by
+    // loadBestOffer or a Cursor. They are removed either lazily, when the
+    // crossing loop reaches them at the top of the book, or in one batch by
+    // expireOffers, meant to run between ledgers. Until then they still count
+    // in size(), loadOffer and the depth aggregates. Expiries are kept in a
+    // timer wheel next to the offer-ID index, so each costs amortized O(1)
+    // and offers without one cost nothing.
+    // - setCloseTime: the close time only moves forward.
+    // - expireOffers: removes every expired offer, returning how many.
+    // - expireBestOffers: removes expired offers from the top of the book
+    //   down to the first live one.
+    void setCloseTime(uint64_t closeTime);
+
+    uint64_t
+    closeTime() const
+    {
+        return mCloseTime;
+    }
+
+    size_t expireOffers();
+    void expireBestOffers();
+    bool isExpired(int64_t offerID) const;
+
+    bool
+    hasExpiringOffers() const
+    {
+        return mExpiries.size() != 0;
+    }
+
+    // Fills an empty book from an unsorted dump of offers; the result is the
+    // same as adding them one by one in offer-ID order. The offers are sorted
+    // on up to `threads` threads (0 picks the hardware concurrency) and the
+    // levels and the index are then filled in one linear pass, instead of a
+    // level search and a shifted mOrder insert per offer. Throws like addOffer
+    // on a malformed or duplicate offer, in which case the book is left empty.
+    // An attached feed gets one LEVEL_ADD per level.
+    void bulkLoad(std::vector<Offer> offers, unsigned threads = 0);
+
+    // Cancels an offer (ManageOffer with amount 0). Returns false if the offer
+    // is not in the book.
+    bool eraseOffer(int64_t offerID);
+
+    // Sets the remaining amount of a resting offer without changing its
+    // position, removing it if amount is 0. This is how the crossing loop
+    // records fills.
+    void setOfferAmount(int64_t offerID, int64_t amount);
+
+    // Level sweep support for the crossing loop (see crossWithOffers):
+    // - bestLevelSlots: the slots of the best level; false if the book is
+    //   empty. Valid until the book changes.
+    // - takeBestOffers: removes the first count live offers of the best
+    //   level, with the same result as filling each of them to 0 with
+    //   setOfferAmount, but a single update of the level's aggregate, depth
+    //   index and feed. The book must have no expiring offers.
+    bool bestLevelSlots(LevelSlots& slots) const;
+    void takeBestOffers(size_t count);
+
+    // Modifies a resting offer (ManageOffer on an existing offer ID). Offers
+    // are ordered by price and then ID, so an offer whose price stays the same
+    // (as a fraction) keeps its place in the queue: its amount is updated in
+    // place in O(1), whether it goes up or down. A new price moves the offer
+    // to its position by ID in the new level. Amount 0 removes the offer.
+    // Returns false if the offer is not in the book.
+    bool amendOffer(int64_t offerID, int64_t amount, Price const& price);
+
+    // The price reported for an offer is the price of its level, which may be
+    // a different (but equal) fraction than the one it was added with.
+    bool loadOffer(int64_t offerID, Offer& offer) const;
+    bool loadBestOffer(Offer& offer) const;
+
+    // Fills levels with the best maxLevels price levels, best first. Each
+    // level keeps its aggregate up to date as offers are added, filled and
+    // removed, so this is O(maxLevels) and never walks the offers.
+    void getDepth(std::vector<DepthLevel>& levels, size_t maxLevels) const;
+
+    // Change tracking for callers that cache what they computed from the top
+    // of the book. Every change to the offers of a level gives it a new
+    // version from a per-book clock, and so does moving the close time of a
+    // book with expiring offers, since that changes which offers count.
+    // - version: changes whenever any level does.
+    // - levelsAtOrBelow: how many levels are priced at or below price.
+    // - stampTopLevels: appends the stamps of the best `levels` levels (all
+    //   of them if there are fewer).
+    // - topLevelsUnchanged: whether the best count levels are exactly the
+    //   stamped ones, in the same state; with wholeBook, also that there are
+    //   no others.
+    uint64_t
+    version() const
+    {
+        return mVersionClock;
+    }
+
+    size_t levelsAtOrBelow(Price const& price) const;
+    void stampTopLevels(size_t levels, std::vector<LevelStamp>& stamps) const;
+    bool topLevelsUnchanged(LevelStamp const* stamps, size_t count,
+                            bool wholeBook) const;
+
+    // Cumulative depth queries over the price levels, answered from a Fenwick
+    // tree indexed by level position in O(log levels):
+    // - depthAtOrBelow: how much wheat is offered at prices <= limit, i.e. how
+    //   much can be bought before the price exceeds limit.
+    // - priceToFill: the price of the level at which the cumulative amount
+    //   first reaches amount (which must be positive). Returns false if the
+    //   whole book holds less than amount.
+    // Fills update the tree in place. Adding or removing a whole level shifts
+    // the positions after it, so the tree is then rebuilt in O(levels) by the
+    // next query instead; that is why the queries are not thread-safe against
+    // each other even though they are const.
+    int64_t depthAtOrBelow(Price const& limit) const;
+    bool priceToFill(int64_t amount, Price& price) const;
+
+    int64_t
+    totalDepth() const
+    {
+        return mTotalDepth;
+    }
+
+    // An upper bound on the wheat a path payment can get for sheep sheep:
+    // levels are taken whole, best first, until the sheep run out, each at
+    // its price plus what path payment rounding may give away (one unit per
+    // offer taken, and no more than 1% of the price).
+    // Walks the level aggregates only, so it costs O(levels reached), keeps
+    // no state and may run concurrently with other const calls.
+    int64_t maxWheatForSheep(int64_t sheep) const;
+
+    // Whether account may have an offer in the book. A false answer is exact
+    // and, since crossing only ever removes offers, stays true for a whole
+    // sweep of the book; see makeOfferFilter.
+    bool
+    mayHaveOffersFrom(AccountID account) const
+    {
+        return mSellers.mayContain(account);
+    }
+
+    // Attaches a feed that receives a level event for every change to a
+    // level's aggregate and, from convertWithOffers, a trade event for every
+    // crossed offer. The feed must outlive the book; pass nullptr to detach.
+    void
+    setMarketDataFeed(MarketDataFeed* feed)
+    {
+        mFeed = feed;
+    }
+
+    MarketDataFeed*
+    marketDataFeed() const
+    {
+        return mFeed;
+    }
+
+    // Attaches a store that keeps the liabilities of the sellers in step with
+    // the offers in the book, which sell wheat for sheep. Every change to an
+    // offer's amount (adding, filling, amending, cancelling or expiring it)
+    // moves its seller's selling liabilities in wheat and buying liabilities
+    // in sheep by the difference, in O(1), instead of recomputing them from
+    // the seller's offers. Attaching adds the liabilities of the offers
+    // already in the book and detaching (nullptr) takes them away again.
+    // Like the feed, the store must outlive the book and carries over to
+    // copies of it.
+    void setAccountStore(AccountStore* store, AssetID wheat, AssetID sheep);
+
+    AccountStore*
+    accountStore() const
+    {
+        return mAccounts;
+    }
+
+    // Calls f on every offer in the book, expired or not, in crossing order.
+    template <typename F>
+    void
+    forEachOffer(F f) const
+    {
+        for (uint32_t level : mOrder)
+        {
+            auto const& pl = mLevels[level];
+            for (uint32_t slot = pl.head; slot < pl.slots(); ++slot)
+            {
+                if (pl.amounts[slot] != 0)
+                {
+                    f(pl.offerAt(slot));
+                }
+            }
+        }
+    }
+
+    // Read-only walk over the offers in crossing order. The book must not be
+    // modified while a cursor is in use.
+    class Cursor
+    {
+      public:
+        explicit Cursor(OrderBook const& book) : mBook(book)
+        {
+        }
+
+        bool next(Offer& offer);
+
+        // Moves past up to count offers, returning how many it passed. Whole
+        // levels are stepped over by their offer count when the book has no
+        // expiring offers.
+        size_t skip(size_t count);
+
+      private:
+        OrderBook const& mBook;
+        size_t mPos{0};
+        uint32_t mSlot{0};
+        bool mInLevel{false};
+    };
+
+    // Incremental compaction, meant to run between ledger closes. Churn
+    // leaves tombstones in the level arrays and capacity behind in levels
+    // that have shrunk, both of which spread the live offers over more cache
+    // lines than they need. Each call walks on from where the previous one
+    // stopped, repacking the live offers of each level it visits contiguously
+    // and in order, trimming its arrays, and updating the index entries of the
+    // offers that moved. Levels are visited until about budget slots have been
+    // handled (at least one level, so every call makes progress), and the
+    // bytes released are returned. Crossing order and aggregates are
+    // unchanged; an open Cursor does not survive a call.
+    size_t compact(size_t budget);
+
+    // Bytes held by the book's level arrays, offer-ID index and expiry
+    // tables.
+    size_t memoryUsage() const;
+
+    size_t
+    size() const
+    {
+        return mIndex.size();
+    }
+
+    size_t
+    numLevels() const
+    {
+        return mOrder.size();
+    }
+
+  private:
+    friend class InvertedBookView;
+
+    // A level stores its offers as parallel arrays. The crossing loop and the
+    // depth queries only read amounts, which are then a dense run of int64_t
+    // the compiler can vectorize over, and the price is stored once per level
+    // rather than once per offer. An offer costs 24 bytes here plus its
+    // offer-ID index slot, instead of a heap node with allocator overhead.
+    struct PriceLevel
+    {
+        Price price;
+        uint32_t head{0}; // first slot that may hold a live offer
+        uint32_t live{0};
+        uint64_t version{0};
+        int64_t depth{0}; // sum of amounts
+        std::vector<int64_t> amounts; // 0 marks a tombstone
+        std::vector<int64_t> offerIDs;
+        std::vector<AccountID> sellers;
+
+        size_t
+        slots() const
+        {
+            return amounts.size();
+        }
+
+        Offer
+        offerAt(uint32_t slot) const
+        {
+            return Offer{sellers[slot], offerIDs[slot], amounts[slot], price};
+        }
+
+        // Heap bytes held by the arrays.
+        size_t
+        bytes() const
+        {
+            return amounts.capacity() * sizeof(int64_t) +
+                   offerIDs.capacity() * sizeof(int64_t) +
+                   sellers.capacity() * sizeof(AccountID);
+        }
+    };
+
+    void reset();
+    void insertOffer(Offer const& offer);
+    size_t compactLevel(uint32_t level);
+    OfferHandle const& findHandle(int64_t offerID) const;
+    uint32_t findOrCreateLevel(Price const& price);
+    size_t orderPosition(Price const& price) const;
+    void removeAt(OfferHandle handle);
+    void dropLevel(uint32_t level);
+    void addDepth(uint32_t level, int64_t delta);
+    void rebuildDepthIndex() const;
+    int64_t walkLevelsForSheep(int64_t sheep, bool perOffer) const;
+    void publishLevel(uint32_t level, MarketDataEventType type) const;
+    void updateLiabilities(AccountID seller, Price const& price,
+                           int64_t oldAmount, int64_t newAmount);
+    void checkLiabilityUpdate(AccountID seller, Price const& oldPrice,
+                              int64_t oldAmount, Price const& newPrice,
+                              int64_t newAmount) const;
+    void checkLiabilities() const;
+    void rebuildSellerFilter();
+
+    // Level storage is a pool so that level indices in handles stay stable
+    // while levels come and go; mOrder lists the live levels best price first.
+    std::vector<PriceLevel> mLevels;
+    std::vector<uint32_t> mFreeLevels;
+    std::vector<uint32_t> mOrder;
+    FlatHashMap64<OfferHandle> mIndex;
+
+    // Sum of all level depths; bounds every prefix sum so none can overflow.
+    int64_t mTotalDepth{0};
+    // Source of level versions. It survives reset(), so a stamp taken before
+    // never matches a level after.
+    uint64_t mVersionClock{0};
+    // 1-indexed Fenwick tree over the depths of the levels in mOrder.
+    mutable std::vector<int64_t> mDepthTree;
+    mutable bool mDepthTreeValid{false};
+
+    MarketDataFeed* mFeed{nullptr};
+    AccountStore* mAccounts{nullptr};
+    AssetID mWheat{0};
+    AssetID mSheep{0};
+
+    // Sized to at least four counters per offer, which bounds the false
+    // positive rate at about 15% even if every offer has its own seller.
+    SellerFilter mSellers;
+
+    // Expiry times of the offers that have one, and the wheel that fires
+    // them. Removing an offer only erases it from mExpiries; its wheel entry
+    // is recognised as stale when it fires.
+    FlatHashMap64<uint64_t> mExpiries;
+    TimerWheel mExpiryWheel;
+    uint64_t mCloseTime{0};
+    std::vector<uint64_t> mFired;
+
+    // Level pool index compact() continues from.
+    uint32_t mCompactNext{0};
+};
+
+// Zero-copy view of a book from the other side of its pair. The book's offers
+// sell wheat for sheep; seen through the view they buy the view's wheat (the
+// book's sheep) with the view's sheep (the book's wheat), at view prices
+// Price{d, n}. A taker crossing the view wants the _highest_ view price, so
+// levels listed in ascending view price come from walking the book's levels
+// backwards, and the offer crossed first is the last one listed. Amounts stay
+// in the asset the offers sell, i.e. the view's sheep.
+class InvertedBookView
+{
+  public:
+    explicit InvertedBookView(OrderBook& book) : mBook(book)
+    {
+    }
+
+    OrderBook&
+    book() const
+    {
+        return mBook;
+    }
+
+    size_t
+    numLevels() const
+    {
+        return mBook.numLevels();
+    }
+
+    // The i-th level in ascending view price; i must be below numLevels().
+    DepthLevel level(size_t i) const;
+
+    bool loadOffer(int64_t offerID, Offer& offer) const;
+    bool loadBestOffer(Offer& offer) const;
+
+    // How much the offers at view prices >= limit sell: what a taker gets
+    // before the view price drops below limit.
+    int64_t
+    depthAtOrAbove(Price const& limit) const
+    {
+        return mBook.depthAtOrBelow(Price{limit.d, limit.n});
+    }
+
+  private:
+    OrderBook& mBook;
+};
+
+// The filter ManageOffer crosses with: stop at the first offer priced above
+// maxWheatPrice (or at it, for passive offers) and at the first offer of the
+// taker itself. When the book holds no offer of the taker the self-cross
+// comparison is skipped for the whole sweep.
+std::function<OfferFilterResult(Offer const&)>
+makeOfferFilter(OrderBook const& book, AccountID taker,
+                Price const& maxWheatPrice, bool passive);
+
+// The same for a taker crossing a view: stop at the first offer whose view
+// price is below minWheatPrice (or at it, for passive offers), where the taker
+// sells the view's wheat.
+std::function<OfferFilterResult(Offer const&)>
+makeOfferFilter(InvertedBookView const& view, AccountID taker,
+                Price const& minWheatPrice, bool passive);
+
+// Where a read-only walk of a book starts: the first `taken` offers in
+// crossing order count as gone and, if partial is non-zero, the next one as
+// holding only that much. Quotes against the same book chain through it, each
+// seeing the fills of the ones before, so a path that crosses a book twice can
+// be quoted in full before anything is applied.
+//
+// This is all the overlay a dry run needs: the crossing loop only ever takes
+// offers from the top of the book, whole except for the last one, and filters
+// can only stop it, so what a sequence of quotes has consumed is always a
+// prefix of the crossing order.
+struct BookPosition
+{
+    size_t taken{0};
+    int64_t partial{0};
+};
+
+// buys wheat with sheep, crossing as many offers in the book as necessary
+ConvertResult
+convertWithOffers(OrderBook& book, int64_t maxSheepSend, int64_t& sheepSend,
+                  int64_t maxWheatReceive, int64_t& wheatReceived,
+                  RoundingType round,
+                  std::function<OfferFilterResult(Offer const&)> filter,
+                  std::vector<ClaimAtom>& offerTrail, int64_t maxOffersToCross);
+
+// Dry run of convertWithOffers: the same exchangeV10 sequence, read from
+// position instead of the top of the book, with the same result and claim
+// atoms. The book is neither modified nor copied; position is moved past the
+// quote's fills and lastAmount is set to what the last offer crossed keeps (0
+// if it was taken whole or nothing was crossed), so commitQuote can apply the
+// quote later. Quotes may run concurrently with each other, but not with
+// changes to the book.
+ConvertResult
+quoteWithOffers(OrderBook const& book, BookPosition& position,
+                int64_t maxSheepSend, int64_t& sheepSend,
+                int64_t maxWheatReceive, int64_t& wheatReceived,
+                RoundingType round,
+                std::function<OfferFilterResult(Offer const&)> const& filter,
+                std::vector<ClaimAtom>& offerTrail, int64_t maxOffersToCross,
+                int64_t& lastAmount);
+
+// Sells the view's wheat for its sheep, crossing the book underneath. This is
+// convertWithOffers on the book with the wheat and sheep limits swapped; the
+// filter sees offers at view prices.
+ConvertResult
+convertWithOffers(InvertedBookView& view, int64_t maxWheatSend,
+                  int64_t& wheatSend, int64_t maxSheepReceive,
+                  int64_t& sheepReceived, RoundingType round,
+                  std::function<OfferFilterResult(Offer const&)> filter,
+                  std::vector<ClaimAtom>& offerTrail, int64_t maxOffersToCross);
+
+// Best-execution routing between the book and a pool, as stellar-core's
+// convertWithOffersAndPools: the pool is used when it can take the whole trade
+// and either the book cannot (the result would not be eOK) or the pool gives a
+// strictly better average price. Only the winner is crossed. Pools only take
+// part in path payments, so with NORMAL rounding (or no pool) this is just
+// convertWithOffers; otherwise maxWheatReceive must be INT64_MAX for strict
+// send and maxSheepSend must be INT64_MAX for strict receive.
+//
+// Quoting the pool is a single division. The book is only quoted when a cheap
+// test cannot settle the choice: the pool wins outright if the book is empty,
+// its best offer would stop the filter, or the pool's price beats 99% of the
+// best offer's price, which is the most any path payment crossing can favor the
+// taker (see checkPriceErrorBound). Otherwise the book is quoted by a read-only
+// walk and, if it wins, the quote's fills are applied as they stand, so no
+// offer goes through exchangeV10 twice.
+ConvertResult convertWithOffersAndPools(
+    OrderBook& book, LiquidityPool* pool, bool sheepIsA, int64_t maxSheepSend,
+    int64_t& sheepSend, int64_t maxWheatReceive, int64_t& wheatReceived,
+    RoundingType round, std::function<OfferFilterResult(Offer const&)> filter,
+    std::vector<ClaimAtom>& offerTrail, int64_t maxOffersToCross);
+
+// What convertWithOffersAndPools would do, worked out without touching the
+// book: the book is read from position, which is moved past the quote's
+// fills, and the pool, if it wins, is updated in place, so callers quoting
+// ahead of a commit pass a copy. Claim atoms are appended to offerTrail as
+// usual and lastAmount is set to what the last offer crossed keeps.
+ConvertResult quoteWithOffersAndPools(
+    OrderBook const& book, BookPosition& position, LiquidityPool* pool,
+    bool sheepIsA, int64_t maxSheepSend, int64_t& sheepSend,
+    int64_t maxWheatReceive, int64_t& wheatReceived, RoundingType round,
+    std::function<OfferFilterResult(Offer const&)> const& filter,
+    std::vector<ClaimAtom>& offerTrail, int64_t maxOffersToCross,
+    int64_t& lastAmount);
+
+// Applies the book fills of a quote, whose claim atoms are offerTrail[first,
+// end), to the book it was taken from. The book must not have changed since,
+// except by committing the quotes this one was chained after, in order. Pool
+// atoms are skipped.
+void commitQuote(OrderBook& book, std::vector<ClaimAtom> const& offerTrail,
+                 size_t first, size_t end, int64_t lastAmount);
+
+// Native CAP-0006 buy offer: buy buyAmount of wheat for at most price sheep per
+// wheat, sending at most maxSheepSend sheep. The book is crossed with
+// maxWheatReceive set to what is left of buyAmount, so exchangeV10 itself
+// stops at the exact amount and the buyer can never over-buy. Whatever cannot
+// be bought is placed straight into sheepBook, the book of offers selling sheep
+// for wheat, as offer offerID at Price{price.d, price.n}; offerAmount is set to
+// its amount in sheep (0 if nothing was placed). Nothing is placed when
+// crossing stopped at the buyer's own offer or at maxOffersToCross, since
+// ManageOffer fails in those cases.
+ConvertResult buyWithOffers(OrderBook& wheatBook, OrderBook& sheepBook,
+                            AccountID buyer, int64_t offerID,
+                            int64_t buyAmount, Price const& price,
+                            bool passive, int64_t maxSheepSend,
+                            int64_t& sheepSend, int64_t& wheatReceived,
+                            int64_t& offerAmount,
+                            std::vector<ClaimAtom>& offerTrail,
+                            int64_t maxOffersToCross);
+}
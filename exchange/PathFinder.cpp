@@ -0,0 +1,444 @@
+// Best-path search over the pair graph of a BookRegistry
+
+#include "PathFinder.h"
+
+#include <algorithm>
+
+namespace stellar
+{
+
+PathFinder::PathFinder(BookRegistry const& registry, size_t beamWidth,
+                       unsigned threads)
+    : mRegistry(registry), mBeamWidth(beamWidth)
+{
+    releaseAssertOrThrow(beamWidth > 0);
+    if (threads == 0)
+    {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    mTrails.resize(threads);
+    for (auto& trail : mTrails)
+    {
+        trail.reserve(MAX_OFFERS_TO_CROSS + 1);
+    }
+    mKept.resize(threads);
+    rebuildGraph();
+    for (unsigned worker = 1; worker < threads; ++worker)
+    {
+        mWorkers.emplace_back([this, worker]() { workerLoop(worker); });
+    }
+}
+
+PathFinder::~PathFinder()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStop = true;
+    }
+    mWake.notify_all();
+    for (auto& w : mWorkers)
+    {
+        w.join();
+    }
+}
+
+void
+PathFinder::rebuildGraph()
+{
+    mEdges.assign(mRegistry.numAssets() + 1, {});
+    mRegistry.forEachBook(
+        [this](AssetID wheat, AssetID sheep, OrderBook const& book) {
+            mEdges[sheep].push_back(Edge{wheat, &book, nullptr, false});
+        });
+    auto addPool = [this](AssetID sheep, AssetID wheat,
+                          LiquidityPool const& pool, bool sheepIsA) {
+        for (auto& edge : mEdges[sheep])
+        {
+            if (edge.to == wheat)
+            {
+                edge.pool = &pool;
+                edge.sheepIsA = sheepIsA;
+                return;
+            }
+        }
+        mEdges[sheep].push_back(Edge{wheat, nullptr, &pool, sheepIsA});
+    };
+    mRegistry.forEachPool(
+        [&addPool](AssetID a, AssetID b, LiquidityPool const& pool) {
+            addPool(a, b, pool, true);
+            addPool(b, a, pool, false);
+        });
+    for (auto& edges : mEdges)
+    {
+        std::sort(edges.begin(), edges.end(),
+                  [](Edge const& x, Edge const& y) { return x.to < y.to; });
+    }
+    mReach.assign((PathPayment::MAX_HOPS + 1) * mEdges.size(), 0);
+    mReachSlack.assign(mReach.size(), 0);
+}
+
+void
+PathFinder::setRate(Edge& edge)
+{
+    edge.best = Price{0, 0};
+    edge.rate = 0;
+    edge.slack = 0;
+    Offer best;
+    if (edge.book && edge.book->loadBestOffer(best))
+    {
+        edge.best = best.price;
+        edge.rate = (double)best.price.d / best.price.n;
+        edge.slack = (double)std::min((int64_t)edge.book->size(),
+                                      int64_t(MAX_OFFERS_TO_CROSS));
+    }
+    if (edge.pool)
+    {
+        int64_t reservesTo =
+            edge.sheepIsA ? edge.pool->reserveA : edge.pool->reserveB;
+        int64_t reservesFrom =
+            edge.sheepIsA ? edge.pool->reserveB : edge.pool->reserveA;
+        if (reservesTo > 0 && reservesFrom > 0)
+        {
+            edge.rate = std::max(edge.rate, (double)reservesFrom / reservesTo);
+        }
+    }
+}
+
+void
+PathFinder::computeReach(AssetID dest, size_t maxHops)
+{
+    size_t const n = mEdges.size();
+    for (auto& edges : mEdges)
+    {
+        for (auto& edge : edges)
+        {
+            setRate(edge);
+        }
+    }
+    std::fill(mReach.begin(), mReach.begin() + n, 0);
+    std::fill(mReachSlack.begin(), mReachSlack.begin() + n, 0);
+    mReach[dest] = 1;
+    for (size_t hops = 1; hops <= maxHops; ++hops)
+    {
+        double const* prev = &mReach[(hops - 1) * n];
+        double const* prevSlack = &mReachSlack[(hops - 1) * n];
+        double* cur = &mReach[hops * n];
+        double* curSlack = &mReachSlack[hops * n];
+        for (AssetID from = 0; from < n; ++from)
+        {
+            // a held here ends as at most rate * a + slack: each hop gives at
+            // most edge.rate * a + edge.slack, and the hops after it scale
+            // that by their rate and add their own slack.
+            double best = prev[from];
+            double slack = prevSlack[from];
+            for (auto const& edge : mEdges[from])
+            {
+                if (prev[edge.to] == 0)
+                {
+                    continue;
+                }
+                best = std::max(best, edge.rate * prev[edge.to]);
+                slack = std::max(slack, edge.slack * prev[edge.to] +
+                                            prevSlack[edge.to]);
+            }
+            cur[from] = best;
+            curSlack[from] = slack;
+        }
+    }
+}
+
+// Whether holding bound of `to` with mHopsLeft hops to go could still give a
+// result better than mThreshold. The rates are floating point, so the result
+// gets a margin far above their rounding error.
+bool
+PathFinder::canImprove(int64_t bound, AssetID to) const
+{
+    size_t i = mHopsLeft * mEdges.size() + to;
+    return mReach[i] > 0 &&
+           ((double)bound * mReach[i] + mReachSlack[i]) * (1 + 1e-9) >
+               mThreshold;
+}
+
+int64_t
+PathFinder::upperBound(Edge const& edge, int64_t amount, bool tight)
+{
+    int64_t bound = 0;
+    if (edge.book && tight)
+    {
+        bound = edge.book->maxWheatForSheep(amount);
+    }
+    else if (edge.book && edge.best.n != 0)
+    {
+        // Everything at the best price, plus the rounding allowance: one unit
+        // per offer that can be taken, and never more than 1%.
+        int64_t perOffer;
+        if (!bigDivide128(bound,
+                          bigMultiply(amount, 100 * (int64_t)edge.best.d),
+                          99 * (int64_t)edge.best.n, ROUND_UP))
+        {
+            bound = INT64_MAX;
+        }
+        else if (bigDivide128(perOffer,
+                              bigMultiply(amount, (int64_t)edge.best.d),
+                              (int64_t)edge.best.n, ROUND_UP) &&
+                 perOffer <= INT64_MAX - (int64_t)edge.slack)
+        {
+            bound = std::min(bound, perOffer + (int64_t)edge.slack);
+        }
+        bound = std::min(bound, edge.book->totalDepth());
+    }
+    if (edge.pool)
+    {
+        int64_t reservesTo =
+            edge.sheepIsA ? edge.pool->reserveA : edge.pool->reserveB;
+        int64_t reservesFrom =
+            edge.sheepIsA ? edge.pool->reserveB : edge.pool->reserveA;
+        uint64_t fromPool = 0;
+        if (reservesTo > 0 && reservesFrom > 0 &&
+            bigDivideUnsigned128(
+                fromPool, bigMultiplyUnsigned(reservesFrom, amount),
+                (uint64_t)reservesTo + (uint64_t)amount, ROUND_UP))
+        {
+            bound = std::max(bound, (int64_t)fromPool);
+        }
+    }
+    return bound;
+}
+
+bool
+PathFinder::quote(Edge const& edge, int64_t amount, int64_t& received,
+                  std::vector<ClaimAtom>& trail) const
+{
+    trail.clear();
+    BookPosition position;
+    LiquidityPool pool{0, 0, 0};
+    if (edge.pool)
+    {
+        pool = *edge.pool;
+    }
+    int64_t sheepSend = 0;
+    int64_t lastAmount = 0;
+    auto res = quoteWithOffersAndPools(
+        edge.book ? *edge.book : mEmptyBook, position,
+        edge.pool ? &pool : nullptr, edge.sheepIsA, amount, sheepSend,
+        INT64_MAX, received, RoundingType::PATH_PAYMENT_STRICT_SEND, nullptr,
+        trail, MAX_OFFERS_TO_CROSS, lastAmount);
+    return res == ConvertResult::eOK && sheepSend == amount && received > 0;
+}
+
+void
+PathFinder::expandGroup(size_t group, unsigned worker)
+{
+    size_t const begin = mGroups[group];
+    size_t const end = mGroups[group + 1];
+    AssetID const to = mCandidates[begin].to;
+    size_t const keep = to == mDest ? mMaxPaths : mBeamWidth;
+
+    // Min-heap of the amounts kept so far; for the destination it starts
+    // with the results of earlier rounds.
+    auto& kept = mKept[worker];
+    kept.clear();
+    if (to == mDest)
+    {
+        for (auto const& result : mResults)
+        {
+            kept.push_back(result.amount);
+        }
+        std::make_heap(kept.begin(), kept.end(), std::greater<int64_t>());
+    }
+
+    auto& paths = mGroupPaths[group];
+    paths.clear();
+    for (size_t i = begin; i < end; ++i)
+    {
+        Candidate const& c = mCandidates[i];
+        if (kept.size() == keep && c.bound <= kept.front())
+        {
+            // Bounds only go down from here.
+            break;
+        }
+        PathQuote const& from = mFrontier[c.path];
+        int64_t received;
+        int64_t tight = upperBound(*c.edge, from.amount, true);
+        if ((kept.size() == keep && tight <= kept.front()) ||
+            !canImprove(tight, to) ||
+            !quote(*c.edge, from.amount, received, mTrails[worker]))
+        {
+            continue;
+        }
+        if (kept.size() == keep)
+        {
+            if (received <= kept.front())
+            {
+                continue;
+            }
+            std::pop_heap(kept.begin(), kept.end(), std::greater<int64_t>());
+            kept.pop_back();
+        }
+        kept.push_back(received);
+        std::push_heap(kept.begin(), kept.end(), std::greater<int64_t>());
+
+        paths.push_back(from);
+        PathQuote& path = paths.back();
+        path.path[path.pathSize++] = to;
+        path.amount = received;
+    }
+}
+
+void
+PathFinder::runOnAllThreads(std::function<void(unsigned)> const& task)
+{
+    if (mWorkers.empty())
+    {
+        task(0);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mTask = &task;
+        mBusy = mWorkers.size();
+        ++mGeneration;
+    }
+    mWake.notify_all();
+    task(0);
+    std::unique_lock<std::mutex> lock(mMutex);
+    mDone.wait(lock, [this]() { return mBusy == 0; });
+    mTask = nullptr;
+}
+
+void
+PathFinder::workerLoop(unsigned worker)
+{
+    uint64_t seen = 0;
+    while (true)
+    {
+        std::function<void(unsigned)> const* task;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mWake.wait(lock,
+                       [&]() { return mStop || mGeneration != seen; });
+            if (mStop)
+            {
+                return;
+            }
+            seen = mGeneration;
+            task = mTask;
+        }
+        (*task)(worker);
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (--mBusy == 0)
+        {
+            mDone.notify_one();
+        }
+    }
+}
+
+static bool
+amountGreater(PathQuote const& a, PathQuote const& b)
+{
+    return a.amount > b.amount;
+}
+
+std::vector<PathQuote>
+PathFinder::findPaths(AssetID source, AssetID dest, int64_t sendAmount,
+                      size_t maxHops, size_t maxPaths)
+{
+    releaseAssertOrThrow(maxHops <= PathPayment::MAX_HOPS);
+    mResults.clear();
+    if (sendAmount <= 0 || maxPaths == 0 || source == dest || source == 0 ||
+        source >= mEdges.size() || dest == 0 || dest >= mEdges.size())
+    {
+        return {};
+    }
+    mDest = dest;
+    mMaxPaths = maxPaths;
+
+    computeReach(dest, maxHops);
+    mThreshold = 0;
+
+    mFrontier.clear();
+    PathQuote start;
+    start.path[0] = source;
+    start.pathSize = 1;
+    start.amount = sendAmount;
+    mFrontier.push_back(start);
+
+    for (size_t hop = 1; hop <= maxHops && !mFrontier.empty(); ++hop)
+    {
+        // Every edge out of every kept path to an asset it does not visit
+        // yet and can reach the destination from in the hops left.
+        mHopsLeft = maxHops - hop;
+        mCandidates.clear();
+        for (uint32_t i = 0; i < mFrontier.size(); ++i)
+        {
+            PathQuote const& p = mFrontier[i];
+            for (auto const& edge : mEdges[p.path[p.pathSize - 1]])
+            {
+                if (mReach[mHopsLeft * mEdges.size() + edge.to] == 0 ||
+                    std::find(p.path.begin(), p.path.begin() + p.pathSize,
+                              edge.to) != p.path.begin() + p.pathSize)
+                {
+                    continue;
+                }
+                int64_t bound = upperBound(edge, p.amount, false);
+                if (bound > 0 && canImprove(bound, edge.to))
+                {
+                    mCandidates.push_back(Candidate{edge.to, i, &edge, bound});
+                }
+            }
+        }
+        std::sort(mCandidates.begin(), mCandidates.end(),
+                  [](Candidate const& a, Candidate const& b) {
+                      return a.to != b.to ? a.to < b.to : a.bound > b.bound;
+                  });
+
+        mGroups.clear();
+        for (size_t i = 0; i < mCandidates.size(); ++i)
+        {
+            if (i == 0 || mCandidates[i].to != mCandidates[i - 1].to)
+            {
+                mGroups.push_back(i);
+            }
+        }
+        size_t const numGroups = mGroups.size();
+        mGroups.push_back(mCandidates.size());
+        if (mGroupPaths.size() < numGroups)
+        {
+            mGroupPaths.resize(numGroups);
+        }
+
+        mNextGroup.store(0, std::memory_order_relaxed);
+        runOnAllThreads([this, numGroups](unsigned worker) {
+            for (size_t g; (g = mNextGroup.fetch_add(1)) < numGroups;)
+            {
+                expandGroup(g, worker);
+            }
+        });
+
+        mNext.clear();
+        for (size_t g = 0; g < numGroups; ++g)
+        {
+            auto& paths = mGroupPaths[g];
+            std::sort(paths.begin(), paths.end(), amountGreater);
+            if (mCandidates[mGroups[g]].to == dest)
+            {
+                mResults.insert(mResults.end(), paths.begin(), paths.end());
+                std::stable_sort(mResults.begin(), mResults.end(),
+                                 amountGreater);
+                if (mResults.size() >= maxPaths)
+                {
+                    mResults.resize(maxPaths);
+                    mThreshold = mResults.back().amount;
+                }
+            }
+            else
+            {
+                mNext.insert(mNext.end(), paths.begin(),
+                            paths.begin() + std::min(paths.size(), mBeamWidth));
+            }
+        }
+        mFrontier.swap(mNext);
+    }
+    return mResults;
+}
+}
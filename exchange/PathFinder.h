@@ -0,0 +1,163 @@
+// Best-path search over the pair graph of a BookRegistry
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+#include "BookRegistry.h"
+#include "OrderBook.h"
+#include "PathPayment.h"
+
+namespace stellar
+{
+
+// A path from the send asset to path[pathSize - 1] and what a strict send of
+// the searched amount delivers along it.
+struct PathQuote
+{
+    std::array<AssetID, PathPayment::MAX_HOPS + 1> path;
+    size_t pathSize;
+    int64_t amount;
+};
+
+// PathFinder answers "what are the best paths to send this much of X as Y"
+// against the books and pools of a registry, for wallets that quote many
+// payments per executed one.
+//
+// The search is a beam search by hop count over simple paths (no asset twice,
+// so no book or pool is crossed twice). Each round expands every path kept so
+// far by one hop, and keeps at most beamWidth paths per asset reached, ranked
+// by the amount they deliver there; paths that reach the destination compete
+// for the maxPaths results instead. Every hop is an exact strict-send quote
+// (quoteWithOffersAndPools: exchangeV10 offer by offer, exchangeWithPool for
+// the pool), the same conversion PathPayment would run.
+//
+// Exact quotes are the cost, so they are pruned with upper bounds on what a
+// hop can deliver. Path payment rounding gives the sender at most one unit
+// per offer taken whole and at most 1% of the price. The loose bound prices
+// the whole send amount at the best offer plus that allowance, capped at the
+// book's total depth; the tight one walks the book's cumulative depth level by
+// level (OrderBook::maxWheatForSheep). Either is raised to the pool's constant
+// product without its fee if the pool gives more. Candidates
+// for the same asset are ranked by the loose bound, which costs one offer
+// lookup, and taken in that order: once the beam for the asset is full of
+// paths beating the next loose bound the rest are dropped, and until then each
+// candidate still has to pass the tight bound before it is quoted.
+//
+// Bounds also look ahead. Before the first round every edge gets the best
+// rate it could give (its best offer's price or the pool's marginal rate) and
+// the units its rounding could add, and a backward pass over the graph turns
+// those into, for every asset and number of hops left, the best rate and
+// allowance with which anything held there could still reach the destination. A candidate whose
+// bound times that rate cannot beat the worst of the maxPaths results found
+// so far is dropped; so is one that cannot reach the destination at all. The
+// short paths found in the first rounds thereby prune most of the later ones.
+//
+// The groups of candidates of different assets are independent, so they are
+// spread over worker threads.
+//
+// The registry is a frozen snapshot for the search: the pair graph is read
+// when the finder is built (rebuildGraph picks up new pairs) and no book or
+// pool may change while a query runs. The search only reads through const
+// accessors that keep no lazily built state, so workers need no locking.
+// Queries on one finder run one at a time; its threads are started once and
+// reused by every query.
+class PathFinder
+{
+  public:
+    // threads == 0 uses one thread per core; the calling thread is one of
+    // them.
+    PathFinder(BookRegistry const& registry, size_t beamWidth,
+               unsigned threads = 0);
+    ~PathFinder();
+
+    PathFinder(PathFinder const&) = delete;
+    PathFinder& operator=(PathFinder const&) = delete;
+
+    void rebuildGraph();
+
+    // The best paths of 1 to maxHops hops (at most PathPayment::MAX_HOPS) for
+    // a strict send of sendAmount of source to dest, best first; at most
+    // maxPaths of them.
+    std::vector<PathQuote> findPaths(AssetID source, AssetID dest,
+                                     int64_t sendAmount, size_t maxHops,
+                                     size_t maxPaths);
+
+  private:
+    // One direction of a pair: selling `from` (sheep) for `to` (wheat).
+    struct Edge
+    {
+        AssetID to;
+        OrderBook const* book;
+        LiquidityPool const* pool;
+        bool sheepIsA;
+        // Set at the start of each query: the price of the best offer, the
+        // best wheat per sheep, and the most rounding can add to rate times
+        // the sheep.
+        Price best{};
+        double rate{0};
+        double slack{0};
+    };
+
+    struct Candidate
+    {
+        AssetID to;
+        uint32_t path;
+        Edge const* edge;
+        int64_t bound;
+    };
+
+    static int64_t upperBound(Edge const& edge, int64_t amount, bool tight);
+    static void setRate(Edge& edge);
+    void computeReach(AssetID dest, size_t maxHops);
+    bool canImprove(int64_t bound, AssetID to) const;
+    bool quote(Edge const& edge, int64_t amount, int64_t& received,
+               std::vector<ClaimAtom>& trail) const;
+    void expandGroup(size_t group, unsigned worker);
+    void runOnAllThreads(std::function<void(unsigned)> const& task);
+    void workerLoop(unsigned worker);
+
+    BookRegistry const& mRegistry;
+    size_t const mBeamWidth;
+    OrderBook mEmptyBook; // stands in for pairs with only a pool
+
+    std::vector<std::vector<Edge>> mEdges; // by sheep asset ID
+
+    // Per-query state.
+    AssetID mDest{0};
+    size_t mMaxPaths{0};
+    // mReach[hops * mEdges.size() + asset]: the best rate from asset to the
+    // destination in at most hops hops, 0 if there is no such path.
+    std::vector<double> mReach;
+    std::vector<double> mReachSlack; // units the rounding may add on top
+    size_t mHopsLeft{0};
+    int64_t mThreshold{0}; // worst result kept, once there are maxPaths
+    std::vector<PathQuote> mFrontier;
+    std::vector<PathQuote> mNext;
+    std::vector<PathQuote> mResults;
+    std::vector<Candidate> mCandidates;
+    std::vector<size_t> mGroups; // candidate index where each group starts
+    std::vector<std::vector<PathQuote>> mGroupPaths;
+    std::atomic<size_t> mNextGroup{0};
+    // Per worker scratch.
+    std::vector<std::vector<ClaimAtom>> mTrails;
+    std::vector<std::vector<int64_t>> mKept;
+
+    // Worker threads wait for a new generation, run mTask and count
+    // themselves out of mBusy.
+    std::vector<std::thread> mWorkers;
+    std::mutex mMutex;
+    std::condition_variable mWake;
+    std::condition_variable mDone;
+    std::function<void(unsigned)> const* mTask{nullptr};
+    uint64_t mGeneration{0};
+    size_t mBusy{0};
+    bool mStop{false};
+};
+}
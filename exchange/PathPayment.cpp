@@ -0,0 +1,246 @@
+// Path payments across the in-memory books and pools of a BookRegistry
+
+#include "PathPayment.h"
+
+#include <algorithm>
+
+namespace stellar
+{
+
+PathPayment::PathPayment(BookRegistry& registry, int64_t maxOffersToCross)
+    : mRegistry(registry), mMaxOffersToCross(maxOffersToCross)
+{
+    releaseAssertOrThrow(maxOffersToCross > 0);
+    // Each hop adds at most one pool atom past the offer limit.
+    mOfferTrail.reserve((size_t)maxOffersToCross + MAX_HOPS);
+}
+
+bool
+PathPayment::setUpHops(AssetID const* path, size_t pathSize, bool reverse)
+{
+    if (pathSize == 0 || pathSize > MAX_HOPS + 1)
+    {
+        return false;
+    }
+    mNumHops = 0;
+    for (size_t k = 0; k + 1 < pathSize; ++k)
+    {
+        size_t from = reverse ? pathSize - 2 - k : k;
+        AssetID sheep = path[from];
+        AssetID wheat = path[from + 1];
+        if (sheep == wheat)
+        {
+            continue;
+        }
+        Hop& hop = mHops[mNumHops++];
+        hop.book = mRegistry.findBook(wheat, sheep);
+        hop.sheepIsA = false;
+        hop.pool = mRegistry.findPool(sheep, wheat, hop.sheepIsA);
+    }
+    return true;
+}
+
+PathPayment::Result
+PathPayment::quoteHop(size_t i, AccountID source, int64_t maxSheepSend,
+                      int64_t& sheepSend, int64_t maxWheatReceive,
+                      int64_t& wheatReceived, RoundingType round)
+{
+    Hop& hop = mHops[i];
+
+    // Chain after the last quote on the same book and pool, if any.
+    hop.bookAfter = BookPosition();
+    if (hop.pool)
+    {
+        hop.poolAfter = *hop.pool;
+    }
+    bool bookSeen = hop.book == nullptr;
+    bool poolSeen = hop.pool == nullptr;
+    for (size_t j = i; j-- > 0 && !(bookSeen && poolSeen);)
+    {
+        if (!bookSeen && mHops[j].book == hop.book)
+        {
+            hop.bookAfter = mHops[j].bookAfter;
+            bookSeen = true;
+        }
+        if (!poolSeen && mHops[j].pool == hop.pool)
+        {
+            hop.poolAfter = mHops[j].poolAfter;
+            poolSeen = true;
+        }
+    }
+
+    OrderBook const& book = hop.book ? *hop.book : mEmptyBook;
+    std::function<OfferFilterResult(Offer const&)> filter;
+    if (book.mayHaveOffersFrom(source))
+    {
+        filter = [source](Offer const& o) {
+            return o.sellerID == source ? OfferFilterResult::eStopCrossSelf
+                                        : OfferFilterResult::eKeep;
+        };
+    }
+
+    hop.trailBegin = mOfferTrail.size();
+    hop.lastAmount = 0;
+    auto res = quoteWithOffersAndPools(
+        book, hop.bookAfter, hop.pool ? &hop.poolAfter : nullptr, hop.sheepIsA,
+        maxSheepSend, sheepSend, maxWheatReceive, wheatReceived, round, filter,
+        mOfferTrail, mMaxOffersToCross, hop.lastAmount);
+    hop.trailEnd = mOfferTrail.size();
+
+    switch (res)
+    {
+    case ConvertResult::eOK:
+        return Result::eSuccess;
+    case ConvertResult::eFilterStopCrossSelf:
+        return Result::eOfferCrossSelf;
+    case ConvertResult::eCrossedTooMany:
+        return Result::eCrossedTooMany;
+    default:
+        return Result::eTooFewOffers;
+    }
+}
+
+void
+PathPayment::commit(bool reverse)
+{
+    // Hops were quoted backward: put the trail, and the commit, in path
+    // order. The trail is turned around in place, then each hop's atoms are
+    // put back in crossing order.
+    if (reverse)
+    {
+        size_t n = mOfferTrail.size();
+        std::reverse(mOfferTrail.begin(), mOfferTrail.end());
+        for (size_t i = 0; i < mNumHops; ++i)
+        {
+            Hop& hop = mHops[i];
+            size_t begin = n - hop.trailEnd;
+            hop.trailEnd = n - hop.trailBegin;
+            hop.trailBegin = begin;
+            std::reverse(mOfferTrail.begin() + hop.trailBegin,
+                         mOfferTrail.begin() + hop.trailEnd);
+        }
+    }
+
+    // Quotes chained on one book must be applied in the order they were
+    // taken, so a path that crosses a book more than once keeps the quoting
+    // order.
+    bool sharedBook = false;
+    for (size_t i = 0; i < mNumHops && !sharedBook; ++i)
+    {
+        for (size_t j = 0; j < i; ++j)
+        {
+            if (mHops[i].book && mHops[i].book == mHops[j].book)
+            {
+                sharedBook = true;
+                break;
+            }
+        }
+    }
+    bool pathOrder = reverse && !sharedBook;
+
+    for (size_t k = 0; k < mNumHops; ++k)
+    {
+        Hop const& hop = mHops[pathOrder ? mNumHops - 1 - k : k];
+        if (hop.book)
+        {
+            commitQuote(*hop.book, mOfferTrail, hop.trailBegin, hop.trailEnd,
+                        hop.lastAmount);
+        }
+    }
+    // Each chained pool quote starts from the one before, so the last one
+    // quoted holds the final reserves.
+    for (size_t i = 0; i < mNumHops; ++i)
+    {
+        if (mHops[i].pool)
+        {
+            *mHops[i].pool = mHops[i].poolAfter;
+        }
+    }
+}
+
+PathPayment::Result
+PathPayment::strictSend(AccountID source, AssetID const* path,
+                        size_t pathSize, int64_t sendAmount, int64_t destMin,
+                        int64_t& destReceived)
+{
+    destReceived = 0;
+    mOfferTrail.clear();
+    if (sendAmount <= 0 || destMin <= 0 ||
+        !setUpHops(path, pathSize, false))
+    {
+        return Result::eMalformed;
+    }
+
+    int64_t amount = sendAmount;
+    for (size_t i = 0; i < mNumHops; ++i)
+    {
+        int64_t sheepSend = 0;
+        int64_t wheatReceived = 0;
+        auto res = quoteHop(i, source, amount, sheepSend, INT64_MAX,
+                            wheatReceived,
+                            RoundingType::PATH_PAYMENT_STRICT_SEND);
+        if (res == Result::eSuccess &&
+            (sheepSend != amount || wheatReceived == 0))
+        {
+            res = Result::eTooFewOffers;
+        }
+        if (res != Result::eSuccess)
+        {
+            mOfferTrail.clear();
+            return res;
+        }
+        amount = wheatReceived;
+    }
+    if (amount < destMin)
+    {
+        mOfferTrail.clear();
+        return Result::eUnderDestMin;
+    }
+
+    commit(false);
+    destReceived = amount;
+    return Result::eSuccess;
+}
+
+PathPayment::Result
+PathPayment::strictReceive(AccountID source, AssetID const* path,
+                           size_t pathSize, int64_t sendMax,
+                           int64_t destAmount, int64_t& sendAmount)
+{
+    sendAmount = 0;
+    mOfferTrail.clear();
+    if (sendMax <= 0 || destAmount <= 0 || !setUpHops(path, pathSize, true))
+    {
+        return Result::eMalformed;
+    }
+
+    int64_t amount = destAmount;
+    for (size_t i = 0; i < mNumHops; ++i)
+    {
+        int64_t sheepSend = 0;
+        int64_t wheatReceived = 0;
+        auto res = quoteHop(i, source, INT64_MAX, sheepSend, amount,
+                            wheatReceived,
+                            RoundingType::PATH_PAYMENT_STRICT_RECEIVE);
+        if (res == Result::eSuccess && wheatReceived != amount)
+        {
+            res = Result::eTooFewOffers;
+        }
+        if (res != Result::eSuccess)
+        {
+            mOfferTrail.clear();
+            return res;
+        }
+        amount = sheepSend;
+    }
+    if (amount > sendMax)
+    {
+        mOfferTrail.clear();
+        return Result::eOverSendMax;
+    }
+
+    commit(true);
+    sendAmount = amount;
+    return Result::eSuccess;
+}
+}
@@ -0,0 +1,104 @@
+// Path payments across the in-memory books and pools of a BookRegistry
+#pragma once
+
+#include <array>
+#include <vector>
+#include <cstdint>
+
+#include "BookRegistry.h"
+#include "OfferExchange.h"
+#include "OrderBook.h"
+
+namespace stellar
+{
+
+// PathPayment runs stellar-core's PathPaymentStrictSend and
+// PathPaymentStrictReceive over the books and pools of a registry. A path is
+// the full list of assets, from the asset sent to the asset received; each
+// consecutive pair is one conversion, routed between the pair's book and pool
+// with convertWithOffersAndPools semantics and the path payment rounding of the
+// operation. Consecutive equal assets are skipped, as in stellar-core.
+//
+// A strict send converts the send amount forward, hop by hop. A strict
+// receive works backward from the destination amount: each hop is quoted in
+// PATH_PAYMENT_STRICT_RECEIVE mode for exactly the wheat the next hop has to
+// send, which gives the sheep it needs in a single walk, so the payment costs
+// one kernel call per offer crossed and never a forward trial run. Either way
+// every hop is only quoted at first, each quote chained after the earlier ones
+// so a book or pool that appears twice is seen in its updated state. Only if
+// the whole payment succeeds, including the sendMax / destMin check, are the
+// quotes committed, in one pass in path order; a failing payment never touches
+// a book or pool, so there is nothing to roll back.
+//
+// All working state is allocated when the executor is built: the per-hop
+// state is a fixed array and the claim-atom trail is reserved for
+// maxOffersToCross, so a payment allocates nothing.
+class PathPayment
+{
+  public:
+    // stellar-core allows 5 intermediate assets.
+    static size_t const MAX_HOPS = 6;
+
+    enum class Result
+    {
+        eSuccess,
+        eMalformed,      // bad amounts, or a path of more than MAX_HOPS
+        eTooFewOffers,   // some hop could not convert its whole amount
+        eOfferCrossSelf, // some hop reached an offer of the source account
+        eCrossedTooMany, // the payment would cross over maxOffersToCross
+        eUnderDestMin,
+        eOverSendMax
+    };
+
+    PathPayment(BookRegistry& registry, int64_t maxOffersToCross);
+
+    // Sends exactly sendAmount of path[0] and delivers at least destMin of
+    // path[pathSize - 1]; destReceived is set to what was delivered.
+    Result strictSend(AccountID source, AssetID const* path, size_t pathSize,
+                      int64_t sendAmount, int64_t destMin,
+                      int64_t& destReceived);
+
+    // Delivers exactly destAmount of path[pathSize - 1] for at most sendMax
+    // of path[0]; sendAmount is set to what was sent.
+    Result strictReceive(AccountID source, AssetID const* path,
+                         size_t pathSize, int64_t sendMax, int64_t destAmount,
+                         int64_t& sendAmount);
+
+    // The claim atoms of the last successful payment, hop by hop in path
+    // order, as stellar-core reports them.
+    std::vector<ClaimAtom> const&
+    offerTrail() const
+    {
+        return mOfferTrail;
+    }
+
+  private:
+    // One conversion, selling sheep for wheat.
+    struct Hop
+    {
+        OrderBook* book; // nullptr if the pair has no book
+        LiquidityPool* pool;
+        bool sheepIsA;
+        LiquidityPool poolAfter; // the pool as the quote leaves it
+        BookPosition bookAfter;  // likewise for the book
+        size_t trailBegin;
+        size_t trailEnd;
+        int64_t lastAmount;
+    };
+
+    bool setUpHops(AssetID const* path, size_t pathSize, bool reverse);
+    Result quoteHop(size_t i, AccountID source, int64_t maxSheepSend,
+                    int64_t& sheepSend, int64_t maxWheatReceive,
+                    int64_t& wheatReceived, RoundingType round);
+    void commit(bool reverse);
+
+    BookRegistry& mRegistry;
+    int64_t const mMaxOffersToCross;
+    OrderBook mEmptyBook; // stands in for pairs without a book
+
+    // Hops in quoting order.
+    std::array<Hop, MAX_HOPS> mHops;
+    size_t mNumHops{0};
+    std::vector<ClaimAtom> mOfferTrail;
+};
+}
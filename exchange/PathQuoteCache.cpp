@@ -0,0 +1,220 @@
+// Cache of path search results, invalidated by the book levels they read
+
+#include "PathQuoteCache.h"
+
+#include <algorithm>
+
+namespace stellar
+{
+
+PathQuoteCache::PathQuoteCache(BookRegistry const& registry,
+                               PathFinder& finder, size_t capacity)
+    : mRegistry(registry), mFinder(finder)
+{
+    releaseAssertOrThrow(capacity > 0);
+    mEntries.resize(capacity);
+    mIndex.reserve(capacity);
+    mTrail.reserve(MAX_OFFERS_TO_CROSS + 1);
+}
+
+void
+PathQuoteCache::clear()
+{
+    mIndex.clear();
+    for (auto& entry : mEntries)
+    {
+        entry.key = 0;
+    }
+    mNextVictim = 0;
+}
+
+bool
+PathQuoteCache::isCurrent(Entry const& entry) const
+{
+    if (entry.numPairs != mRegistry.numBooks() + mRegistry.numPools())
+    {
+        return false;
+    }
+    for (auto const& read : entry.books)
+    {
+        if (!read.book->topLevelsUnchanged(&entry.stamps[read.stampBegin],
+                                           read.stampCount, read.wholeBook))
+        {
+            return false;
+        }
+    }
+    for (auto const& read : entry.pools)
+    {
+        if (read.pool->reserveA != read.reserveA ||
+            read.pool->reserveB != read.reserveB)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Quotes path for entry.sendAmount the way PathFinder does, recording what
+// every hop read. Returns false if the path no longer delivers anything.
+bool
+PathQuoteCache::quotePath(Entry& entry, PathQuote& path)
+{
+    int64_t amount = entry.sendAmount;
+    for (size_t i = 1; i < path.pathSize; ++i)
+    {
+        AssetID sheep = path.path[i - 1];
+        AssetID wheat = path.path[i];
+        OrderBook const* book = mRegistry.findBook(wheat, sheep);
+        bool sheepIsA = false;
+        LiquidityPool const* pool = mRegistry.findPool(sheep, wheat, sheepIsA);
+        LiquidityPool copy = pool ? *pool : LiquidityPool{0, 0, 0};
+
+        BookPosition position;
+        int64_t sheepSend, received, lastAmount;
+        mTrail.clear();
+        auto res = quoteWithOffersAndPools(
+            book ? *book : mEmptyBook, position, pool ? &copy : nullptr,
+            sheepIsA, amount, sheepSend, INT64_MAX, received,
+            RoundingType::PATH_PAYMENT_STRICT_SEND, nullptr, mTrail,
+            MAX_OFFERS_TO_CROSS, lastAmount);
+
+        if (pool)
+        {
+            entry.pools.push_back(
+                PoolRead{pool, pool->reserveA, pool->reserveB});
+        }
+        if (book)
+        {
+            // Whatever the router picked, the book's own quote decided it, so
+            // the hop depends on the levels that quote reads: down to its
+            // last offer, plus the next level, which a quote stopped by the
+            // crossing limit looks at and a new level could slip in before.
+            if (mTrail.empty() || mTrail.back().offerID == 0)
+            {
+                int64_t bookSend, bookReceived;
+                mTrail.clear();
+                position = BookPosition();
+                quoteWithOffers(*book, position, amount, bookSend, INT64_MAX,
+                                bookReceived,
+                                RoundingType::PATH_PAYMENT_STRICT_SEND,
+                                nullptr, mTrail, MAX_OFFERS_TO_CROSS,
+                                lastAmount);
+            }
+            size_t levels = 1;
+            Offer last;
+            if (!mTrail.empty() &&
+                book->loadOffer(mTrail.back().offerID, last))
+            {
+                levels = book->levelsAtOrBelow(last.price) + 1;
+            }
+            size_t begin = entry.stamps.size();
+            book->stampTopLevels(levels, entry.stamps);
+            size_t count = entry.stamps.size() - begin;
+            entry.books.push_back(BookRead{book, (uint32_t)begin,
+                                           (uint32_t)count, count < levels});
+        }
+
+        if (res != ConvertResult::eOK || sheepSend != amount || received <= 0)
+        {
+            return false;
+        }
+        amount = received;
+    }
+    path.amount = amount;
+    return true;
+}
+
+void
+PathQuoteCache::fill(Entry& entry, int64_t sendAmount)
+{
+    entry.sendAmount = sendAmount;
+    entry.numPairs = mRegistry.numBooks() + mRegistry.numPools();
+    entry.books.clear();
+    entry.stamps.clear();
+    entry.pools.clear();
+    auto kept = entry.paths.begin();
+    for (auto& path : entry.paths)
+    {
+        if (quotePath(entry, path))
+        {
+            *kept++ = path;
+        }
+    }
+    entry.paths.erase(kept, entry.paths.end());
+    std::stable_sort(entry.paths.begin(), entry.paths.end(),
+                     [](PathQuote const& a, PathQuote const& b) {
+                         return a.amount > b.amount;
+                     });
+}
+
+std::vector<PathQuote> const&
+PathQuoteCache::findPaths(AssetID source, AssetID dest, int64_t sendAmount,
+                          size_t maxHops, size_t maxPaths)
+{
+    releaseAssertOrThrow(maxHops <= PathPayment::MAX_HOPS);
+
+    // Asset IDs take 24 bits of the key; anything else is not cached.
+    Entry* entry = nullptr;
+    uint64_t key = 0;
+    if (sendAmount > 0 && source != 0 && source < (1u << 24) && dest != 0 &&
+        dest < (1u << 24))
+    {
+        uint64_t bits = 0;
+        for (uint64_t a = (uint64_t)sendAmount; a != 0; a >>= 1)
+        {
+            ++bits;
+        }
+        key = ((uint64_t)source << 40) | ((uint64_t)dest << 16) |
+              (bits << 8) | maxHops;
+        if (auto index = mIndex.find(key))
+        {
+            entry = &mEntries[*index];
+        }
+    }
+
+    if (entry && entry->maxPaths == maxPaths && isCurrent(*entry))
+    {
+        if (entry->sendAmount == sendAmount)
+        {
+            ++mStats.hits;
+            return entry->paths;
+        }
+        fill(*entry, sendAmount);
+        if (!entry->paths.empty())
+        {
+            ++mStats.requotes;
+            return entry->paths;
+        }
+    }
+
+    ++mStats.searches;
+    if (key == 0)
+    {
+        mUncached =
+            mFinder.findPaths(source, dest, sendAmount, maxHops, maxPaths);
+        return mUncached;
+    }
+    if (!entry)
+    {
+        entry = &mEntries[mNextVictim];
+        if (entry->key != 0)
+        {
+            mIndex.erase(entry->key);
+        }
+        mIndex.insert(key, (uint32_t)mNextVictim);
+        mNextVictim = (mNextVictim + 1) % mEntries.size();
+    }
+    entry->key = key;
+    entry->maxPaths = maxPaths;
+    entry->paths =
+        mFinder.findPaths(source, dest, sendAmount, maxHops, maxPaths);
+    fill(*entry, sendAmount);
+    if (entry->paths.empty())
+    {
+        // Nothing read, so nothing would ever drop it.
+        mIndex.erase(key);
+        entry->key = 0;
+    }
+    return entry->paths;
+}
+}
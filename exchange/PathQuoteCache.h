@@ -0,0 +1,109 @@
+// Cache of path search results, invalidated by the book levels they read
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "BookRegistry.h"
+#include "FlatHashMap.h"
+#include "OrderBook.h"
+#include "PathFinder.h"
+
+namespace stellar
+{
+
+// PathQuoteCache sits in front of a PathFinder for the queries wallets repeat
+// between ledgers. Entries are keyed by source, destination, hop limit and an
+// amount bucket (the bit length of the send amount), and hold the paths found
+// together with what their quotes read: for every hop, the stamps of the book
+// levels crossed (OrderBook::stampTopLevels) and the pool reserves.
+//
+// A lookup checks those stamps against the books. If none of them changed and
+// the amount is the one quoted, the stored quotes are returned as they are,
+// without running a single kernel call. If only the amount differs within the
+// bucket, the stored paths are quoted again for it, which is a handful of
+// hops instead of a search. Anything else searches again. Crossings, fills,
+// cancels and amends touching a level a path read change its version, so they
+// drop exactly the entries that depended on that level; activity deeper in
+// the same books, or in books the paths do not cross, leaves them alone. New
+// pairs (a changed number of books or pools) drop every entry.
+//
+// An entry vouches for the paths it holds, not for the absence of better ones:
+// a path elsewhere that improves is only found by the next search for the
+// key. Callers bound that staleness with clear(), e.g. every few ledgers.
+// For the same reason a search that finds nothing is not kept.
+//
+// The cache holds up to capacity entries and replaces the oldest when full.
+// Like the finder, it reads the registry as a frozen snapshot during a lookup
+// and serves one lookup at a time.
+class PathQuoteCache
+{
+  public:
+    struct Stats
+    {
+        uint64_t hits;     // served without quoting
+        uint64_t requotes; // stored paths quoted for a new amount
+        uint64_t searches;
+    };
+
+    PathQuoteCache(BookRegistry const& registry, PathFinder& finder,
+                   size_t capacity);
+
+    // As PathFinder::findPaths. The result stays valid until the next call.
+    std::vector<PathQuote> const& findPaths(AssetID source, AssetID dest,
+                                            int64_t sendAmount,
+                                            size_t maxHops, size_t maxPaths);
+
+    void clear();
+
+    Stats const&
+    stats() const
+    {
+        return mStats;
+    }
+
+  private:
+    // What one hop of a stored path read from its book.
+    struct BookRead
+    {
+        OrderBook const* book;
+        uint32_t stampBegin;
+        uint32_t stampCount;
+        bool wholeBook;
+    };
+
+    struct PoolRead
+    {
+        LiquidityPool const* pool;
+        int64_t reserveA;
+        int64_t reserveB;
+    };
+
+    struct Entry
+    {
+        uint64_t key{0};
+        int64_t sendAmount;
+        size_t maxPaths;
+        size_t numPairs; // books plus pools when filled
+        std::vector<PathQuote> paths;
+        std::vector<BookRead> books;
+        std::vector<LevelStamp> stamps;
+        std::vector<PoolRead> pools;
+    };
+
+    bool isCurrent(Entry const& entry) const;
+    void fill(Entry& entry, int64_t sendAmount);
+    bool quotePath(Entry& entry, PathQuote& path);
+
+    BookRegistry const& mRegistry;
+    PathFinder& mFinder;
+    OrderBook mEmptyBook; // stands in for pairs with only a pool
+
+    FlatHashMap64<uint32_t> mIndex; // key to entry
+    std::vector<Entry> mEntries;
+    size_t mNextVictim{0};
+    std::vector<ClaimAtom> mTrail;
+    std::vector<PathQuote> mUncached;
+    Stats mStats{0, 0, 0};
+};
+}
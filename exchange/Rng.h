@@ -0,0 +1,21 @@
+// Deterministic random numbers for the randomized tests and the benchmarks
+#pragma once
+
+#include <cstdint>
+
+namespace stellar
+{
+
+// Knuth's MMIX LCG; each call gives the high bits, as a non-negative int64_t.
+struct Rng
+{
+    uint64_t seed;
+
+    int64_t
+    operator()()
+    {
+        seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+        return (int64_t)(seed >> 33);
+    }
+};
+}
@@ -0,0 +1,22 @@
+// SHA-256, used to derive liquidity pool IDs
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace stellar
+{
+
+typedef std::array<uint8_t, 32> Hash;
+
+// Hashes len bytes at data. On x86-64 CPUs with the SHA extensions the
+// compression function runs on SHA-NI; anywhere else, or if the CPU lacks
+// them, it runs the portable implementation. The choice is made once, on the
+// first call.
+Hash sha256(uint8_t const* data, size_t len);
+
+// The portable implementation alone, and whether sha256 uses SHA-NI.
+Hash sha256Portable(uint8_t const* data, size_t len);
+bool sha256IsAccelerated();
+}
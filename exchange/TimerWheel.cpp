@@ -0,0 +1,142 @@
+// Hierarchical timer wheel used by the in-memory order book for offer expiry
+
+#include "TimerWheel.h"
+
+#include <stdexcept>
+
+namespace stellar
+{
+
+TimerWheel::TimerWheel(uint64_t now) : mNow(now)
+{
+}
+
+void
+TimerWheel::place(Entry const& entry)
+{
+    if (entry.expiry <= mNow)
+    {
+        mDue.push_back(entry);
+        return;
+    }
+    unsigned msb = 63 - __builtin_clzll(entry.expiry ^ mNow);
+    unsigned level = msb / BITS;
+    if (level >= LEVELS)
+    {
+        mOverflow.push_back(entry);
+        return;
+    }
+    unsigned slot = (unsigned)(entry.expiry >> (level * BITS)) & (SLOTS - 1);
+    mSlots[level][slot].push_back(entry);
+    mOccupied[level] |= 1ull << slot;
+}
+
+void
+TimerWheel::schedule(uint64_t id, uint64_t expiry)
+{
+    place(Entry{id, expiry});
+    ++mSize;
+}
+
+void
+TimerWheel::fireOrPlace(std::vector<Entry>& entries,
+                        std::vector<uint64_t>& fired)
+{
+    // entries may be a slot that place() refills, so work on a copy.
+    mScratch.clear();
+    mScratch.swap(entries);
+    for (auto const& e : mScratch)
+    {
+        if (e.expiry <= mNow)
+        {
+            fired.push_back(e.id);
+            --mSize;
+        }
+        else
+        {
+            place(e);
+        }
+    }
+    mScratch.clear();
+}
+
+void
+TimerWheel::advance(uint64_t now, std::vector<uint64_t>& fired)
+{
+    if (now < mNow)
+    {
+        throw std::runtime_error("timer wheel cannot go back in time");
+    }
+    fireOrPlace(mDue, fired);
+
+    while (mNow < now)
+    {
+        // The next time anything happens: the start of the next occupied slot
+        // on any level, or the top level wrapping around if there is overflow.
+        // Every occupied slot lies after the current one on its level.
+        uint64_t next = UINT64_MAX;
+        unsigned nextLevel = LEVELS;
+        for (unsigned level = 0; level < LEVELS; ++level)
+        {
+            unsigned shift = level * BITS;
+            unsigned digit = (unsigned)(mNow >> shift) & (SLOTS - 1);
+            uint64_t later = digit == SLOTS - 1
+                                 ? 0
+                                 : mOccupied[level] & (~0ull << (digit + 1));
+            if (later)
+            {
+                uint64_t base = (mNow >> (shift + BITS)) << (shift + BITS);
+                uint64_t t = base + ((uint64_t)__builtin_ctzll(later) << shift);
+                if (t < next)
+                {
+                    next = t;
+                    nextLevel = level;
+                }
+            }
+        }
+        if (!mOverflow.empty())
+        {
+            unsigned shift = LEVELS * BITS;
+            uint64_t t = ((mNow >> shift) + 1) << shift;
+            if (t != 0 && t < next)
+            {
+                next = t;
+                nextLevel = LEVELS;
+            }
+        }
+
+        if (next > now)
+        {
+            mNow = now;
+            break;
+        }
+        mNow = next;
+        if (nextLevel == LEVELS)
+        {
+            fireOrPlace(mOverflow, fired);
+        }
+        else
+        {
+            unsigned slot =
+                (unsigned)(mNow >> (nextLevel * BITS)) & (SLOTS - 1);
+            mOccupied[nextLevel] &= ~(1ull << slot);
+            fireOrPlace(mSlots[nextLevel][slot], fired);
+        }
+    }
+}
+
+size_t
+TimerWheel::memoryUsage() const
+{
+    size_t entries = mDue.capacity() + mOverflow.capacity() +
+                     mScratch.capacity();
+    for (auto const& level : mSlots)
+    {
+        for (auto const& slot : level)
+        {
+            entries += slot.capacity();
+        }
+    }
+    return entries * sizeof(Entry);
+}
+}
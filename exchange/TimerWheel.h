@@ -0,0 +1,72 @@
+// Hierarchical timer wheel used by the in-memory order book for offer expiry
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+namespace stellar
+{
+
+// TimerWheel schedules IDs to fire at a time (in whatever unit the caller
+// uses, ledger close times for the book). It has LEVELS wheels of 64 slots;
+// level k holds the entries whose expiry first differs from the current time
+// in bits [6k, 6k + 6), in the slot given by those bits. When time reaches the
+// start of such a slot its entries are redistributed to lower levels, and at
+// level 0 they fire. Each entry is therefore moved at most LEVELS times between
+// being scheduled and firing, so scheduling and expiry are amortized O(1), and
+// advancing over a quiet stretch of time jumps straight to the next occupied
+// slot rather than ticking through it.
+//
+// Entries cannot be cancelled. The owner instead checks each fired ID against
+// its own record of the expiry and ignores the stale ones; every entry is still
+// only handled a bounded number of times.
+class TimerWheel
+{
+  public:
+    explicit TimerWheel(uint64_t now = 0);
+
+    uint64_t
+    now() const
+    {
+        return mNow;
+    }
+
+    size_t
+    size() const
+    {
+        return mSize;
+    }
+
+    // An expiry at or before now fires on the next advance.
+    void schedule(uint64_t id, uint64_t expiry);
+
+    // Advances to time now (which must not go backwards) and appends the IDs
+    // of all entries with expiry <= now to fired.
+    void advance(uint64_t now, std::vector<uint64_t>& fired);
+
+    size_t memoryUsage() const;
+
+  private:
+    static unsigned const BITS = 6;
+    static unsigned const SLOTS = 1 << BITS;
+    static unsigned const LEVELS = 6;
+
+    struct Entry
+    {
+        uint64_t id;
+        uint64_t expiry;
+    };
+
+    void place(Entry const& entry);
+    void fireOrPlace(std::vector<Entry>& entries, std::vector<uint64_t>& fired);
+
+    std::vector<Entry> mSlots[LEVELS][SLOTS];
+    uint64_t mOccupied[LEVELS] = {}; // bit s set iff slot s is non-empty
+    std::vector<Entry> mDue;         // scheduled at or before mNow
+    std::vector<Entry> mOverflow;    // beyond the top level
+    std::vector<Entry> mScratch;
+    uint64_t mNow;
+    size_t mSize{0};
+};
+}
@@ -0,0 +1,404 @@
+// Benchmarks for the in-memory order book:
+// - routing overhead per trade: convertWithOffersAndPools against the plain
+//   crossing loop, for path payments small enough to leave the top offer
+//   partially filled;
+// - a dry-run quote against crossing a copy of the book;
+// - building a book from an unsorted offer dump with bulkLoad against adding
+//   the offers one by one;
+// - path search queries per second over a dense pair graph, and through the
+//   quote cache for repeated queries;
+// - batch auction clearing: finding the price against allocating the fills;
+// - a market order that sweeps deep levels, crossed a level at a time against
+//   offer by offer (a quote, committed).
+#include <chrono>
+#include <cstdio>
+#include "OfferExchange.h"
+#include "OrderBook.h"
+#include "BookRegistry.h"
+#include "PathFinder.h"
+#include "PathQuoteCache.h"
+#include "BatchAuction.h"
+#include "Rng.h"
+
+using namespace stellar;
+
+static int64_t const TRADES = 1000000;
+
+static void
+fillBook(OrderBook& book)
+{
+    int64_t id = 0;
+    for (int32_t level = 0; level < 1000; ++level)
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            book.addOffer(
+                Offer{(AccountID)(id % 97 + 1), ++id, INT64_MAX / 8000,
+                      Price{1000 + level, 1000}});
+        }
+    }
+}
+
+// ns per trade for a strict send of sendAmount sheep, routed through pool if it
+// is not null.
+static double
+run(LiquidityPool* pool, int64_t sendAmount)
+{
+    OrderBook book;
+    fillBook(book);
+    std::vector<ClaimAtom> trail;
+    trail.reserve(16);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int64_t i = 0; i < TRADES; ++i)
+    {
+        int64_t sheepSend, wheatReceived;
+        trail.clear();
+        if (pool)
+        {
+            convertWithOffersAndPools(
+                book, pool, true, sendAmount, sheepSend, INT64_MAX,
+                wheatReceived, RoundingType::PATH_PAYMENT_STRICT_SEND, nullptr,
+                trail, 1000);
+        }
+        else
+        {
+            convertWithOffers(book, sendAmount, sheepSend, INT64_MAX,
+                              wheatReceived,
+                              RoundingType::PATH_PAYMENT_STRICT_SEND, nullptr,
+                              trail, 1000);
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() /
+           TRADES;
+}
+
+static int64_t const DUMP_SIZE = 4000000;
+
+static double
+seconds(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                         start)
+        .count();
+}
+
+static void
+benchBulkLoad()
+{
+    Rng next{1};
+    std::vector<Offer> dump;
+    dump.reserve(DUMP_SIZE);
+    for (int64_t id = 1; id <= DUMP_SIZE; ++id)
+    {
+        dump.push_back(Offer{(AccountID)(next() % 100000 + 1), id,
+                             next() % 1000000 + 1,
+                             Price{(int32_t)(next() % 100000 + 1), 1000}});
+    }
+    for (size_t i = dump.size() - 1; i > 0; --i)
+    {
+        std::swap(dump[i], dump[next() % (i + 1)]);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    {
+        OrderBook book;
+        for (auto const& offer : dump)
+        {
+            book.addOffer(offer);
+        }
+    }
+    double incremental = seconds(start);
+
+    start = std::chrono::steady_clock::now();
+    {
+        OrderBook book;
+        book.bulkLoad(dump, 1);
+    }
+    double serial = seconds(start);
+
+    start = std::chrono::steady_clock::now();
+    {
+        OrderBook book;
+        book.bulkLoad(dump);
+    }
+    double parallel = seconds(start);
+
+    std::printf("%lld offers, addOffer:    %7.3f s\n", (long long)DUMP_SIZE,
+                incremental);
+    std::printf("%lld offers, bulkLoad x1: %7.3f s\n", (long long)DUMP_SIZE,
+                serial);
+    std::printf("%lld offers, bulkLoad:    %7.3f s\n", (long long)DUMP_SIZE,
+                parallel);
+}
+
+// ns per quote of a sweep through the top 20 offers, as a dry run and by
+// crossing a copy of the book, which is what quoting took before.
+static void
+benchQuote()
+{
+    OrderBook book;
+    fillBook(book);
+    std::vector<ClaimAtom> trail;
+    trail.reserve(32);
+    int64_t const sweep = INT64_MAX / 8000 * 20;
+    int const QUOTES = 20000;
+    int64_t received = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < QUOTES; ++i)
+    {
+        int64_t sheepSend, wheatReceived, lastAmount;
+        BookPosition position;
+        trail.clear();
+        quoteWithOffers(book, position, INT64_MAX, sheepSend, sweep,
+                        wheatReceived, RoundingType::NORMAL, nullptr, trail,
+                        1000, lastAmount);
+        received += wheatReceived;
+    }
+    double dryRun = seconds(start) * 1e9 / QUOTES;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < QUOTES / 100; ++i)
+    {
+        int64_t sheepSend, wheatReceived;
+        OrderBook copy = book;
+        trail.clear();
+        convertWithOffers(copy, INT64_MAX, sheepSend, sweep, wheatReceived,
+                          RoundingType::NORMAL, nullptr, trail, 1000);
+        received -= 100 * wheatReceived;
+    }
+    double copied = seconds(start) * 1e9 / (QUOTES / 100);
+    releaseAssertOrThrow(received == 0);
+
+    std::printf("quote, dry run:         %7.1f ns/quote\n", dryRun);
+    std::printf("quote, copy and cross:  %7.1f ns/quote\n", copied);
+}
+
+// 200 assets shaped like the public network: 5 hub assets trading with each
+// other and with everything, plus 3 random pairs per asset. Every pair has a
+// 50-offer book each way, priced from 0.1% to 5% above the pair's fair rate,
+// and the hub pairs also have pools. Queries are strict sends of up to 4 hops
+// between random assets.
+static void
+benchPathFinder()
+{
+    Rng next{3};
+    AssetID const numAssets = 200;
+    AssetID const numHubs = 5;
+    BookRegistry registry;
+    std::vector<int32_t> value(numAssets + 1);
+    for (AccountID issuer = 1; issuer <= numAssets; ++issuer)
+    {
+        registry.intern(makeAsset("B" + std::to_string(issuer), issuer));
+        value[issuer] = (int32_t)(500 + next() % 1500);
+    }
+    int64_t id = 0;
+    auto addPair = [&](AssetID x, AssetID y) {
+        if (x == y || registry.findBook(x, y))
+        {
+            return;
+        }
+        for (int side = 0; side < 2; ++side)
+        {
+            AssetID wheat = side ? y : x;
+            AssetID sheep = side ? x : y;
+            OrderBook& book = registry.book(wheat, sheep);
+            for (int i = 0; i < 50; ++i)
+            {
+                Price price{value[wheat] * (int32_t)(1001 + next() % 50),
+                            value[sheep] * 1000};
+                book.addOffer(Offer{1, ++id,
+                                    adjustOffer(price, 1000000, INT64_MAX),
+                                    price});
+            }
+        }
+        if (x <= numHubs && y <= numHubs)
+        {
+            bool xIsA;
+            LiquidityPool& pool = registry.pool(x, y, xIsA);
+            pool.reserveA = (xIsA ? value[y] : value[x]) * (int64_t)100000;
+            pool.reserveB = (xIsA ? value[x] : value[y]) * (int64_t)100000;
+        }
+    };
+    for (AssetID x = 1; x <= numAssets; ++x)
+    {
+        for (AssetID hub = 1; hub <= numHubs; ++hub)
+        {
+            addPair(x, hub);
+        }
+        for (int i = 0; i < 3; ++i)
+        {
+            addPair(x, (AssetID)(next() % numAssets + 1));
+        }
+    }
+
+    for (unsigned threads : {1u, 0u})
+    {
+        PathFinder finder(registry, 4, threads);
+        int const QUERIES = 2000;
+        size_t found = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int q = 0; q < QUERIES; ++q)
+        {
+            AssetID source = (AssetID)(next() % numAssets + 1);
+            AssetID dest = (AssetID)(next() % (numAssets - 1) + 1);
+            dest += dest >= source;
+            found += finder.findPaths(source, dest, 5000000, 4, 3).size();
+        }
+        double elapsed = seconds(start);
+        std::printf("path search, %s: %7.0f queries/s (%zu paths)\n",
+                    threads == 1 ? "1 thread " : "all cores",
+                    QUERIES / elapsed, found);
+    }
+
+    // The same queries repeating between ledgers: 100 keys, each asked 20
+    // times, with a trade on one of the hub books after every 50 queries.
+    PathFinder finder(registry, 4, 1);
+    PathQuoteCache cache(registry, finder, 256);
+    std::vector<std::pair<AssetID, AssetID>> keys;
+    for (int k = 0; k < 100; ++k)
+    {
+        AssetID source = (AssetID)(next() % numAssets + 1);
+        AssetID dest = (AssetID)(next() % (numAssets - 1) + 1);
+        keys.emplace_back(source, dest + (dest >= source));
+    }
+    std::vector<ClaimAtom> trail;
+    auto start = std::chrono::steady_clock::now();
+    for (int q = 0; q < 2000; ++q)
+    {
+        auto const& key = keys[next() % keys.size()];
+        cache.findPaths(key.first, key.second, 5000000, 4, 3);
+        if (q % 50 == 49)
+        {
+            AssetID hub = (AssetID)(next() % numHubs + 1);
+            AssetID other = (AssetID)(next() % numAssets + 1);
+            if (OrderBook* book = registry.findBook(hub, other))
+            {
+                int64_t sheepSend, wheatReceived;
+                trail.clear();
+                convertWithOffers(*book, 1000000, sheepSend, INT64_MAX,
+                                  wheatReceived,
+                                  RoundingType::PATH_PAYMENT_STRICT_SEND,
+                                  nullptr, trail, 1000);
+            }
+        }
+    }
+    double elapsed = seconds(start);
+    std::printf("path search, cached:    %7.0f queries/s (%llu searched)\n",
+                2000 / elapsed,
+                (unsigned long long)cache.stats().searches);
+}
+
+static void
+benchBatchAuction()
+{
+    // An interval's worth of orders: 100k on each side, over 100 levels each,
+    // crossing over about a third of them.
+    Rng next{9};
+    OrderBook asks, bids;
+    int64_t id = 0;
+    for (int i = 0; i < 100000; ++i)
+    {
+        Price ask{(int32_t)(9600 + next() % 100 * 10), 10000};
+        asks.addOffer(Offer{(AccountID)(next() % 1000 + 1), ++id,
+                            adjustOffer(ask, 1000 + next() % 100000, INT64_MAX),
+                            ask});
+        Price bid{10000, (int32_t)(9300 + next() % 100 * 10)};
+        bids.addOffer(Offer{(AccountID)(next() % 1000 + 1), ++id,
+                            adjustOffer(bid, 1000 + next() % 100000, INT64_MAX),
+                            bid});
+    }
+
+    size_t levels = asks.numLevels() + bids.numLevels();
+    int const RUNS = 1000;
+    Price price;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < RUNS; ++i)
+    {
+        findClearingPrice(asks, bids, price);
+    }
+    double find = seconds(start) / RUNS;
+
+    std::vector<AuctionMatch> matches;
+    start = std::chrono::steady_clock::now();
+    clearBatchAuction(asks, bids, price, matches);
+    double clear = seconds(start);
+    std::printf("batch auction, price:   %7.1f us (%zu levels)\n",
+                find * 1e6, levels);
+    std::printf("batch auction, clear:   %7.1f ms (%zu matches)\n",
+                clear * 1e3, matches.size());
+}
+
+static void
+benchLevelSweep()
+{
+    // 20 levels of 5000 offers each, all taken by one order.
+    OrderBook book;
+    int64_t id = 0;
+    for (int level = 0; level < 20; ++level)
+    {
+        Price price{10000 + level * 10, 10000};
+        for (int i = 0; i < 5000; ++i)
+        {
+            book.addOffer(Offer{(AccountID)(i % 1000 + 1), ++id,
+                                adjustOffer(price, 1000 + i, INT64_MAX),
+                                price});
+        }
+    }
+    OrderBook perOffer = book;
+
+    int64_t sheepSend, wheatReceived, lastAmount;
+    std::vector<ClaimAtom> trail, quotedTrail;
+    trail.reserve(id);
+    quotedTrail.reserve(id);
+    auto start = std::chrono::steady_clock::now();
+    convertWithOffers(book, INT64_MAX, sheepSend, INT64_MAX, wheatReceived,
+                      RoundingType::NORMAL, nullptr, trail, INT64_MAX);
+    double sweep = seconds(start);
+
+    start = std::chrono::steady_clock::now();
+    BookPosition position;
+    quoteWithOffers(perOffer, position, INT64_MAX, sheepSend, INT64_MAX,
+                    wheatReceived, RoundingType::NORMAL, nullptr, quotedTrail,
+                    INT64_MAX, lastAmount);
+    commitQuote(perOffer, quotedTrail, 0, quotedTrail.size(), lastAmount);
+    double single = seconds(start);
+    std::printf("deep sweep, by level:   %7.1f ns/offer (%zu offers)\n",
+                sweep * 1e9 / trail.size(), trail.size());
+    std::printf("deep sweep, by offer:   %7.1f ns/offer\n",
+                single * 1e9 / quotedTrail.size());
+}
+
+int
+main()
+{
+    // Reserves are large enough that a million trades barely move the price.
+    int64_t const reserve = (int64_t)1 << 50;
+    double book = run(nullptr, 1000);
+
+    // Pool at half the book's price: settled by the cheap pre-comparison.
+    LiquidityPool cheap{reserve, 2 * reserve, 30};
+    double poolWins = run(&cheap, 1000);
+
+    // Pool at twice the book's price: the book has to be quoted first.
+    LiquidityPool dear{2 * reserve, reserve, 30};
+    double bookWins = run(&dear, 1000);
+
+    // Pool within a fraction of a percent of the book's best price.
+    LiquidityPool close{reserve + reserve / 500, reserve, 0};
+    double tight = run(&close, 1000);
+
+    std::printf("book only:              %7.1f ns/trade\n", book);
+    std::printf("router, pool wins:      %7.1f ns/trade\n", poolWins);
+    std::printf("router, book wins:      %7.1f ns/trade\n", bookWins);
+    std::printf("router, close prices:   %7.1f ns/trade\n", tight);
+
+    benchQuote();
+    benchBulkLoad();
+    benchPathFinder();
+    benchBatchAuction();
+    benchLevelSweep();
+    return 0;
+}
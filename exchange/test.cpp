@@ -1,7 +1,17 @@
 // Test drivers adapted from stellar-core/src/transactions/test for OfferExchange translation unit
 
 #include <cassert>
+#include <map>
 #include "OfferExchange.h"
+#include "OrderBook.h"
+#include "BookRegistry.h"
+#include "PathPayment.h"
+#include "PathFinder.h"
+#include "PathQuoteCache.h"
+#include "ArbitrageDetector.h"
+#include "AccountStore.h"
+#include "BatchAuction.h"
+#include "Rng.h"
 
 using namespace stellar;
 
@@ -12,9 +22,62 @@ void testLimitedByMaxWheatReceiveAndMaxSheepReceive();
 void testLimitedByMaxWheatSendAndMaxWheatReceive();
 void testLimitedByMaxSheepSendAndMaxSheepReceive();
 void testThreshold();
+void testOfferHandleTable();
+void testOrderBookCancel();
+void testOrderBookCompactLayout();
+void testOrderBookDepth();
+void testOrderBookCumulativeDepth();
+void testMarketDataFeed();
+void testSelfCrossFilter();
+void testBuyOffer();
+void testBookAndPoolRouting();
+void testOrderBookBulkLoad();
+void testAmendOffer();
+void testInvertedBookView();
+void testOfferExpiry();
+void testOrderBookCompaction();
+void testBookRegistry();
+void testPoolID();
+void testPathPayment();
+void testPathFinder();
+void testQuoteWithOffers();
+void testPathQuoteCache();
+void testArbitrageDetector();
+void testAccountStore();
+void testOfferLiabilities();
+void testBatchAuction();
+void testLevelSweep();
 
 int main()
 {
+    testOfferHandleTable();
+    testOrderBookCancel();
+    testOrderBookCompactLayout();
+    testOrderBookDepth();
+    testOrderBookCumulativeDepth();
+    testMarketDataFeed();
+    testSelfCrossFilter();
+    testBuyOffer();
+    testBookAndPoolRouting();
+    testOrderBookBulkLoad();
+    testAmendOffer();
+    testInvertedBookView();
+    testOfferExpiry();
+    testOrderBookCompaction();
+    testBookRegistry();
+    testPoolID();
+    testPathPayment();
+    testPathFinder();
+    testQuoteWithOffers();
+    testPathQuoteCache();
+    testArbitrageDetector();
+    testAccountStore();
+    testOfferLiabilities();
+    testBatchAuction();
+    testLevelSweep();
+
+    // The exchangeV10 cases adapted from stellar-core come last: the
+    // strict send rounding case still throws in this translation.
     // testRoundingForPATH_PAYMENT_STRICT_RECEIVE();
     testRoundingForPATH_PAYMENT_STRICT_SEND();
     // testLimitedByMaxWheatSendAndMaxSheepSend();
@@ -274,3 +337,2167 @@ void testThreshold() {
     checkExchangeV10(Price{3, 2}, 52, 50, 50, 75);
 }
 
+
+// SECTION("Offer handle table survives cancel/replace churn")
+void testOfferHandleTable() {
+    FlatHashMap64<OfferHandle> index;
+    for (uint64_t id = 1; id <= 10000; ++id)
+    {
+        assert(index.insert(id, OfferHandle{(uint32_t)id, (uint32_t)(id * 3)}));
+    }
+    assert(!index.insert(42, OfferHandle{0, 0}));
+    for (uint64_t id = 1; id <= 10000; id += 2)
+    {
+        assert(index.erase(id));
+    }
+    assert(!index.erase(1));
+    assert(index.size() == 5000);
+    for (uint64_t id = 1; id <= 10000; ++id)
+    {
+        auto h = index.find(id);
+        if (id % 2)
+        {
+            assert(!h);
+        }
+        else
+        {
+            assert(h && h->level == id && h->slot == id * 3);
+        }
+    }
+}
+
+// SECTION("Cancel and cross through the offer-ID index")
+void testOrderBookCancel() {
+    OrderBook book;
+    book.addOffer(Offer{1, 10, 100, Price{3, 2}});
+    book.addOffer(Offer{2, 11, 100, Price{1, 1}});
+    book.addOffer(Offer{3, 12, 50, Price{2, 2}});
+    book.addOffer(Offer{4, 13, 70, Price{1, 1}});
+    assert(book.numLevels() == 2);
+
+    Offer offer;
+    assert(book.loadBestOffer(offer) && offer.offerID == 11);
+
+    // Cancelling from the middle of a level keeps the others reachable.
+    assert(book.eraseOffer(12));
+    assert(!book.eraseOffer(12));
+    assert(!book.loadOffer(12, offer));
+    assert(book.loadOffer(13, offer) && offer.amount == 70);
+
+    int64_t sheepSend, wheatReceived;
+    std::vector<ClaimAtom> trail;
+    auto res = convertWithOffers(book, INT64_MAX, sheepSend, 120,
+                                 wheatReceived, RoundingType::NORMAL, nullptr,
+                                 trail, INT64_MAX);
+    assert(res == ConvertResult::eOK);
+    assert(wheatReceived == 120 && sheepSend == 120);
+    assert(trail.size() == 2);
+    assert(trail[0].offerID == 11 && trail[1].offerID == 13);
+    assert(!book.loadOffer(11, offer));
+    assert(book.loadOffer(13, offer) && offer.amount == 50);
+
+    // Cancelling the partially crossed offer empties its level.
+    assert(book.eraseOffer(13));
+    assert(book.numLevels() == 1);
+    assert(book.loadBestOffer(offer) && offer.offerID == 10);
+
+    trail.clear();
+    res = convertWithOffers(book, INT64_MAX, sheepSend, INT64_MAX,
+                            wheatReceived, RoundingType::NORMAL, nullptr,
+                            trail, INT64_MAX);
+    assert(res == ConvertResult::ePartial);
+    assert(wheatReceived == 100 && sheepSend == 150);
+    assert(book.size() == 0 && book.numLevels() == 0);
+}
+
+// SECTION("Offers are stored column-wise per level")
+void testOrderBookCompactLayout() {
+    OrderBook book;
+    int64_t const numOffers = 100000;
+    for (int64_t id = 1; id <= numOffers; ++id)
+    {
+        book.addOffer(Offer{(AccountID)(id % 97), id, id, Price{(int32_t)(id % 100 + 1), 7}});
+    }
+    assert(book.size() == (size_t)numOffers);
+    assert(book.numLevels() == 100);
+    // 24 bytes of level arrays plus at most 32 bytes of index per offer, with
+    // headroom for vector growth.
+    assert(book.memoryUsage() < (size_t)numOffers * 96);
+
+    Offer offer;
+    assert(book.loadOffer(4242, offer));
+    assert(offer.sellerID == 4242 % 97 && offer.amount == 4242);
+    assert(offer.price.n == 4242 % 100 + 1 && offer.price.d == 7);
+
+    // Equal fractions share a level and report its price.
+    book.addOffer(Offer{1, numOffers + 1, 5, Price{2, 14}});
+    assert(book.numLevels() == 100);
+    assert(book.loadOffer(numOffers + 1, offer));
+    assert(offer.price.n == 1 && offer.price.d == 7);
+}
+
+// SECTION("Depth aggregates follow adds, fills and removals")
+void testOrderBookDepth() {
+    OrderBook book;
+    book.addOffer(Offer{1, 1, 100, Price{1, 1}});
+    book.addOffer(Offer{2, 2, 50, Price{1, 1}});
+    book.addOffer(Offer{3, 3, 30, Price{2, 1}});
+    book.addOffer(Offer{4, 4, 10, Price{3, 1}});
+
+    std::vector<DepthLevel> depth;
+    book.getDepth(depth, 2);
+    assert(depth.size() == 2);
+    assert(depth[0].amount == 150 && depth[0].numOffers == 2);
+    assert(depth[1].amount == 30 && depth[1].numOffers == 1);
+
+    int64_t sheepSend, wheatReceived;
+    std::vector<ClaimAtom> trail;
+    convertWithOffers(book, INT64_MAX, sheepSend, 160, wheatReceived,
+                      RoundingType::NORMAL, nullptr, trail, INT64_MAX);
+    assert(wheatReceived == 160);
+    book.getDepth(depth, 10);
+    assert(depth.size() == 2);
+    assert(depth[0].amount == 20 && depth[0].numOffers == 1);
+    assert(depth[0].price.n == 2 && depth[0].price.d == 1);
+    assert(depth[1].amount == 10);
+
+    book.eraseOffer(4);
+    book.getDepth(depth, 10);
+    assert(depth.size() == 1 && depth[0].amount == 20);
+
+    // The aggregate must always equal the sum over the level's offers.
+    Offer offer;
+    assert(book.loadOffer(3, offer) && offer.amount == depth[0].amount);
+}
+
+// SECTION("Cumulative depth and price-to-fill agree with a walk of the levels")
+void testOrderBookCumulativeDepth() {
+    OrderBook book;
+    Rng next{12345};
+    auto check = [&book]() {
+        std::vector<DepthLevel> depth;
+        book.getDepth(depth, SIZE_MAX);
+        int64_t cumulative = 0;
+        for (auto const& level : depth)
+        {
+            cumulative += level.amount;
+            assert(book.depthAtOrBelow(level.price) == cumulative);
+            Price p;
+            assert(book.priceToFill(cumulative, p));
+            assert((int64_t)p.n * level.price.d == (int64_t)level.price.n * p.d);
+        }
+        assert(cumulative == book.totalDepth());
+        Price p;
+        assert(!book.priceToFill(cumulative + 1, p));
+        assert(book.depthAtOrBelow(Price{1, INT32_MAX}) == 0);
+    };
+
+    int64_t id = 0;
+    for (int round = 0; round < 50; ++round)
+    {
+        for (int i = 0; i < 20; ++i)
+        {
+            book.addOffer(Offer{1, ++id, next() % 1000 + 1,
+                                Price{(int32_t)(next() % 50 + 1), 10}});
+        }
+        check();
+        for (int i = 0; i < 5; ++i)
+        {
+            book.eraseOffer(next() % id + 1);
+        }
+        check();
+        int64_t sheepSend, wheatReceived;
+        std::vector<ClaimAtom> trail;
+        convertWithOffers(book, INT64_MAX, sheepSend, next() % 3000 + 1,
+                          wheatReceived, RoundingType::NORMAL, nullptr, trail,
+                          INT64_MAX);
+        check();
+    }
+}
+
+// SECTION("Crossing publishes trades and level changes into the feed")
+void testMarketDataFeed() {
+    MarketDataFeed feed(8);
+    OrderBook book;
+    book.setMarketDataFeed(&feed);
+    book.addOffer(Offer{7, 1, 100, Price{1, 1}});
+    book.addOffer(Offer{8, 2, 50, Price{1, 1}});
+    book.addOffer(Offer{9, 3, 40, Price{2, 1}});
+
+    int64_t sheepSend, wheatReceived;
+    std::vector<ClaimAtom> trail;
+    convertWithOffers(book, INT64_MAX, sheepSend, 120, wheatReceived,
+                      RoundingType::NORMAL, nullptr, trail, INT64_MAX);
+
+    struct Expected
+    {
+        MarketDataEventType type;
+        int64_t amount;
+        int64_t count;
+    };
+    Expected expected[] = {
+        {MarketDataEventType::LEVEL_ADD, 100, 1},
+        {MarketDataEventType::LEVEL_MODIFY, 150, 2},
+        {MarketDataEventType::LEVEL_ADD, 40, 1},
+        {MarketDataEventType::TRADE, 100, 100},
+        {MarketDataEventType::LEVEL_MODIFY, 50, 1},
+        {MarketDataEventType::TRADE, 20, 20},
+        {MarketDataEventType::LEVEL_MODIFY, 30, 1},
+    };
+    uint64_t seq = 1;
+    for (auto const& e : expected)
+    {
+        MarketDataEvent event;
+        assert(feed.read(seq, event) == MarketDataFeed::ReadResult::eOK);
+        assert(event.seq == seq);
+        assert(event.type == e.type);
+        assert(event.amount == e.amount && event.count == e.count);
+        ++seq;
+    }
+    MarketDataEvent event;
+    assert(feed.read(seq, event) == MarketDataFeed::ReadResult::eNotYet);
+
+    // A consumer that falls a full ring behind is told so.
+    book.eraseOffer(2);
+    book.eraseOffer(3);
+    assert(feed.read(seq, event) == MarketDataFeed::ReadResult::eOK);
+    assert(event.type == MarketDataEventType::LEVEL_DELETE);
+    assert(feed.read(1, event) == MarketDataFeed::ReadResult::eOverwritten);
+    assert(feed.nextSequence() == 10);
+}
+
+// SECTION("Self-cross detection through the seller filter")
+void testSelfCrossFilter() {
+    OrderBook book;
+    for (int64_t id = 1; id <= 5000; ++id)
+    {
+        book.addOffer(Offer{(AccountID)(id % 1000 + 1), id, 10, Price{1, 1}});
+    }
+    for (AccountID a = 1; a <= 1000; ++a)
+    {
+        assert(book.mayHaveOffersFrom(a));
+    }
+    int falsePositives = 0;
+    for (AccountID a = 100000; a < 110000; ++a)
+    {
+        falsePositives += book.mayHaveOffersFrom(a) ? 1 : 0;
+    }
+    assert(falsePositives < 500);
+
+    // Removing an account's offers never hides the accounts still there.
+    for (int64_t id = 7; id <= 5000; id += 1000)
+    {
+        book.eraseOffer(id);
+    }
+    for (AccountID a = 1; a <= 1000; ++a)
+    {
+        assert(a == 8 || book.mayHaveOffersFrom(a));
+    }
+
+    // Once its offers are gone the filter forgets an account; exactly so
+    // when it was the only one, as every counter is back to 0.
+    OrderBook single;
+    single.addOffer(Offer{8, 1, 10, Price{1, 1}});
+    single.addOffer(Offer{8, 2, 10, Price{2, 1}});
+    assert(single.mayHaveOffersFrom(8));
+    single.eraseOffer(1);
+    assert(single.mayHaveOffersFrom(8));
+    single.eraseOffer(2);
+    assert(!single.mayHaveOffersFrom(8));
+
+    int64_t sheepSend, wheatReceived;
+    std::vector<ClaimAtom> trail;
+    auto res = convertWithOffers(book, INT64_MAX, sheepSend, INT64_MAX,
+                                 wheatReceived, RoundingType::NORMAL,
+                                 makeOfferFilter(book, 6, Price{1, 1}, false),
+                                 trail, INT64_MAX);
+    assert(res == ConvertResult::eFilterStopCrossSelf);
+    assert(trail.size() == 4 && trail.back().sellerID == 5);
+
+    trail.clear();
+    res = convertWithOffers(book, INT64_MAX, sheepSend, INT64_MAX,
+                            wheatReceived, RoundingType::NORMAL,
+                            makeOfferFilter(book, 8, Price{1, 1}, true), trail,
+                            INT64_MAX);
+    assert(res == ConvertResult::eFilterStopBadPrice && trail.empty());
+}
+
+// SECTION("Buy offers never over-buy and rest as sell offers")
+void testBuyOffer() {
+    // The example from OfferExchange.h, scaled by 100: 2500 wheat for sale at
+    // 0.05 sheep per wheat, buyer willing to pay up to 1/15 sheep per wheat.
+    OrderBook wheatBook, sheepBook;
+    wheatBook.addOffer(Offer{1, 1, 2500, Price{1, 20}});
+
+    int64_t sheepSend, wheatReceived, offerAmount;
+    std::vector<ClaimAtom> trail;
+    auto res = buyWithOffers(wheatBook, sheepBook, 2, 100, 1000, Price{1, 15},
+                             false, 1000000, sheepSend, wheatReceived,
+                             offerAmount, trail, INT64_MAX);
+    assert(res == ConvertResult::eOK);
+    assert(wheatReceived == 1000 && sheepSend == 50);
+    assert(offerAmount == 0 && sheepBook.size() == 0);
+
+    // Buying more than is for sale places the rest directly in the other book.
+    trail.clear();
+    res = buyWithOffers(wheatBook, sheepBook, 2, 101, 2000, Price{1, 15},
+                        false, 1000000, sheepSend, wheatReceived, offerAmount,
+                        trail, INT64_MAX);
+    assert(res == ConvertResult::ePartial);
+    assert(wheatReceived == 1500 && sheepSend == 75);
+    assert(offerAmount == 33);
+    Offer offer;
+    assert(sheepBook.loadOffer(101, offer));
+    assert(offer.amount == 33 && offer.price.n == 15 && offer.price.d == 1);
+
+    // Limited by the sheep the buyer can send.
+    wheatBook.addOffer(Offer{1, 2, 2500, Price{1, 20}});
+    trail.clear();
+    res = buyWithOffers(wheatBook, sheepBook, 3, 102, 2000, Price{1, 15},
+                        false, 10, sheepSend, wheatReceived, offerAmount,
+                        trail, INT64_MAX);
+    assert(res == ConvertResult::eOK);
+    assert(wheatReceived == 200 && sheepSend == 10 && offerAmount == 0);
+}
+
+// SECTION("Router picks the same venue as crossing both and comparing")
+void testBookAndPoolRouting() {
+    OrderBook empty;
+    LiquidityPool pool{1000000, 2000000, 30};
+    int64_t sheepSend, wheatReceived;
+    std::vector<ClaimAtom> trail;
+    auto res = convertWithOffersAndPools(
+        empty, &pool, true, 1000, sheepSend, INT64_MAX, wheatReceived,
+        RoundingType::PATH_PAYMENT_STRICT_SEND, nullptr, trail, INT64_MAX);
+    assert(res == ConvertResult::eOK);
+    assert(sheepSend == 1000 && wheatReceived == 1992);
+    assert(pool.reserveA == 1001000 && pool.reserveB == 2000000 - 1992);
+    assert(trail.size() == 1 && trail[0].offerID == 0);
+
+    Rng next{777};
+    int64_t id = 0;
+    int bookWins = 0, poolWins = 0;
+    for (int round = 0; round < 400; ++round)
+    {
+        OrderBook book;
+        int levels = (int)(next() % 6);
+        for (int i = 0; i < levels; ++i)
+        {
+            // Offers rest in the book already adjusted, as ManageOffer leaves
+            // them.
+            Price price{(int32_t)(next() % 20 + 90), 100};
+            int64_t amount = adjustOffer(price, next() % 5000 + 1, INT64_MAX);
+            if (amount > 0)
+            {
+                book.addOffer(Offer{1, ++id, amount, price});
+            }
+        }
+        // The pool price sits around the book's.
+        LiquidityPool start{next() % 20000 + 90000, 100000,
+                            (int32_t)(next() % 100)};
+        bool strictSend = next() % 2;
+        RoundingType rt = strictSend ? RoundingType::PATH_PAYMENT_STRICT_SEND
+                                     : RoundingType::PATH_PAYMENT_STRICT_RECEIVE;
+        int64_t maxSend = strictSend ? next() % 8000 + 1 : INT64_MAX;
+        int64_t maxReceive = strictSend ? INT64_MAX : next() % 8000 + 1;
+        int64_t maxCross = next() % 4 + 1;
+
+        // Reference: cross a copy of the book, quote the pool, and apply
+        // stellar-core's rule.
+        OrderBook reference = book;
+        int64_t depth = book.totalDepth();
+        int64_t sheepBook, wheatBook;
+        std::vector<ClaimAtom> refTrail;
+        auto refRes = convertWithOffers(reference, maxSend, sheepBook,
+                                        maxReceive, wheatBook, rt, nullptr,
+                                        refTrail, maxCross);
+        int64_t sheepPool = 0, wheatPool = 0;
+        bool poolOK = exchangeWithPool(start.reserveA, maxSend, sheepPool,
+                                       start.reserveB, maxReceive, wheatPool,
+                                       start.feeBps, rt) &&
+                      sheepPool > 0 && wheatPool > 0;
+        bool expectPool =
+            poolOK && (refRes != ConvertResult::eOK ||
+                       bigMultiply(sheepPool, wheatBook) <
+                           bigMultiply(sheepBook, wheatPool));
+
+        pool = start;
+        trail.clear();
+        res = convertWithOffersAndPools(book, &pool, true, maxSend, sheepSend,
+                                        maxReceive, wheatReceived, rt, nullptr,
+                                        trail, maxCross);
+        if (expectPool)
+        {
+            ++poolWins;
+            assert(res == ConvertResult::eOK);
+            assert(sheepSend == sheepPool && wheatReceived == wheatPool);
+            assert(pool.reserveA == start.reserveA + sheepPool);
+            assert(pool.reserveB == start.reserveB - wheatPool);
+            assert(book.totalDepth() == depth);
+        }
+        else
+        {
+            ++bookWins;
+            assert(res == refRes);
+            assert(sheepSend == sheepBook && wheatReceived == wheatBook);
+            assert(pool.reserveA == start.reserveA &&
+                   pool.reserveB == start.reserveB);
+            assert(trail.size() == refTrail.size());
+            assert(book.totalDepth() == reference.totalDepth());
+        }
+    }
+    assert(bookWins > 0 && poolWins > 0);
+}
+
+// SECTION("Bulk load matches adding the offers one by one")
+void testOrderBookBulkLoad() {
+    Rng next{4242};
+    std::vector<Offer> dump;
+    for (int64_t id = 1; id <= 300000; ++id)
+    {
+        // Equal-ratio prices (k/10 and 2k/20) must share a level.
+        int32_t k = (int32_t)(next() % 200 + 1);
+        Price price = next() % 2 ? Price{k, 10} : Price{2 * k, 20};
+        dump.push_back(Offer{(AccountID)(next() % 1000 + 1), id,
+                             next() % 1000 + 1, price});
+    }
+    OrderBook incremental;
+    for (auto const& offer : dump)
+    {
+        incremental.addOffer(offer);
+    }
+    for (size_t i = dump.size() - 1; i > 0; --i)
+    {
+        std::swap(dump[i], dump[next() % (i + 1)]);
+    }
+
+    OrderBook bulk;
+    bulk.bulkLoad(dump, 4);
+    assert(bulk.size() == incremental.size());
+    assert(bulk.numLevels() == incremental.numLevels());
+    assert(bulk.totalDepth() == incremental.totalDepth());
+    for (auto const& offer : dump)
+    {
+        Offer a, b;
+        assert(bulk.loadOffer(offer.offerID, a));
+        assert(incremental.loadOffer(offer.offerID, b));
+        assert(a.amount == b.amount && a.price.n == b.price.n &&
+               a.price.d == b.price.d);
+        assert(bulk.mayHaveOffersFrom(offer.sellerID));
+    }
+    assert(bulk.depthAtOrBelow(Price{10, 10}) ==
+           incremental.depthAtOrBelow(Price{10, 10}));
+
+    // Both books cross identically.
+    int64_t sheepA, wheatA, sheepB, wheatB;
+    std::vector<ClaimAtom> trailA, trailB;
+    convertWithOffers(bulk, INT64_MAX, sheepA, 5000000, wheatA,
+                      RoundingType::NORMAL, nullptr, trailA, INT64_MAX);
+    convertWithOffers(incremental, INT64_MAX, sheepB, 5000000, wheatB,
+                      RoundingType::NORMAL, nullptr, trailB, INT64_MAX);
+    assert(sheepA == sheepB && wheatA == wheatB);
+    assert(trailA.size() == trailB.size());
+    for (size_t i = 0; i < trailA.size(); ++i)
+    {
+        assert(trailA[i].offerID == trailB[i].offerID);
+    }
+
+    // Only an empty book can be bulk loaded, and a duplicate leaves it empty.
+    bool threw = false;
+    try
+    {
+        bulk.bulkLoad(dump);
+    }
+    catch (std::runtime_error&)
+    {
+        threw = true;
+    }
+    assert(threw && bulk.size() != 0);
+
+    OrderBook dup;
+    dump.push_back(dump.front());
+    threw = false;
+    try
+    {
+        dup.bulkLoad(dump);
+    }
+    catch (std::runtime_error&)
+    {
+        threw = true;
+    }
+    assert(threw && dup.size() == 0 && dup.numLevels() == 0);
+}
+
+// SECTION("Amending keeps time priority unless the price changes")
+void testAmendOffer() {
+    OrderBook book;
+    book.addOffer(Offer{1, 1, 100, Price{1, 1}});
+    book.addOffer(Offer{2, 2, 100, Price{1, 1}});
+    book.addOffer(Offer{3, 3, 100, Price{1, 1}});
+    book.addOffer(Offer{4, 4, 100, Price{2, 1}});
+
+    // Same price, written as another fraction: amended in place, both down
+    // and up, and offer 1 stays first in the queue.
+    assert(book.amendOffer(1, 40, Price{2, 2}));
+    assert(book.amendOffer(1, 60, Price{1, 1}));
+    Offer best;
+    assert(book.loadBestOffer(best) && best.offerID == 1 && best.amount == 60);
+    std::vector<DepthLevel> depth;
+    book.getDepth(depth, 2);
+    assert(depth[0].amount == 260 && depth[0].numOffers == 3);
+    assert(book.totalDepth() == 360);
+
+    // A new price moves offer 3 into the level at 2/1, ahead of offer 4 since
+    // its ID is lower.
+    assert(book.amendOffer(3, 50, Price{2, 1}));
+    book.getDepth(depth, 2);
+    assert(depth[0].amount == 160 && depth[0].numOffers == 2);
+    assert(depth[1].amount == 150 && depth[1].numOffers == 2);
+    int64_t sheepSend, wheatReceived;
+    std::vector<ClaimAtom> trail;
+    convertWithOffers(book, INT64_MAX, sheepSend, 190, wheatReceived,
+                      RoundingType::NORMAL, nullptr, trail, INT64_MAX);
+    assert(trail.size() == 3);
+    assert(trail[0].offerID == 1 && trail[1].offerID == 2 &&
+           trail[2].offerID == 3);
+    Offer offer;
+    assert(book.loadOffer(3, offer) && offer.amount == 20);
+    assert(book.loadOffer(4, offer) && offer.amount == 100);
+
+    // Moving an offer can empty its level, and amount 0 removes it.
+    assert(book.amendOffer(4, 100, Price{3, 1}));
+    assert(book.numLevels() == 2);
+    assert(book.amendOffer(3, 0, Price{2, 1}));
+    assert(book.numLevels() == 1 && book.size() == 1);
+    assert(book.totalDepth() == 100);
+    assert(!book.amendOffer(3, 10, Price{2, 1}));
+}
+
+// SECTION("Inverted view lists and crosses the book from the other side")
+void testInvertedBookView() {
+    OrderBook book;
+    book.addOffer(Offer{1, 1, 100, Price{1, 2}});
+    book.addOffer(Offer{2, 2, 200, Price{1, 1}});
+    book.addOffer(Offer{3, 3, 300, Price{2, 1}});
+    InvertedBookView view(book);
+
+    // Ascending view price: 1/2, 1/1, 2/1 -- the book's levels backwards.
+    assert(view.numLevels() == 3);
+    DepthLevel l = view.level(0);
+    assert(l.price.n == 1 && l.price.d == 2 && l.amount == 300);
+    l = view.level(2);
+    assert(l.price.n == 2 && l.price.d == 1 && l.amount == 100);
+    Offer best;
+    assert(view.loadBestOffer(best));
+    assert(best.offerID == 1 && best.price.n == 2 && best.price.d == 1);
+    assert(view.depthAtOrAbove(Price{1, 1}) == 300);
+
+    // Selling up to 300 of the view's wheat with a floor of 1/1 crosses
+    // offers 1 and 2 and stops at offer 3, whose view price is 1/2.
+    OrderBook copy = book;
+    int64_t wheatSend, sheepReceived;
+    std::vector<ClaimAtom> trail;
+    auto res = convertWithOffers(view, 300, wheatSend, INT64_MAX,
+                                 sheepReceived, RoundingType::NORMAL,
+                                 makeOfferFilter(view, 9, Price{1, 1}, false),
+                                 trail, INT64_MAX);
+    assert(res == ConvertResult::eFilterStopBadPrice);
+    assert(wheatSend == 250 && sheepReceived == 300);
+    assert(trail.size() == 2);
+
+    // Which is what crossing the book directly with the limits swapped does.
+    int64_t sheepSend, wheatReceived;
+    trail.clear();
+    res = convertWithOffers(copy, 300, sheepSend, INT64_MAX, wheatReceived,
+                            RoundingType::NORMAL,
+                            makeOfferFilter(copy, 9, Price{1, 1}, false),
+                            trail, INT64_MAX);
+    assert(res == ConvertResult::eFilterStopBadPrice);
+    assert(sheepSend == wheatSend && wheatReceived == sheepReceived);
+
+    // A passive floor at the best view price stops immediately.
+    trail.clear();
+    res = convertWithOffers(view, 10, wheatSend, INT64_MAX, sheepReceived,
+                            RoundingType::NORMAL,
+                            makeOfferFilter(view, 9, Price{1, 2}, true), trail,
+                            INT64_MAX);
+    assert(res == ConvertResult::eFilterStopBadPrice && trail.empty());
+}
+
+// SECTION("Expired offers are skipped, then removed lazily or in a batch")
+void testOfferExpiry() {
+    // The wheel fires every entry exactly once, at its expiry, across jumps
+    // of every size.
+    TimerWheel wheel(1000);
+    Rng next{99};
+    std::vector<uint64_t> expiries;
+    for (uint64_t id = 0; id < 5000; ++id)
+    {
+        uint64_t expiry = 1000 + (next() % 4 == 0 ? next() % 100000000
+                                                  : next() % 5000);
+        expiries.push_back(expiry);
+        wheel.schedule(id + 1, expiry);
+    }
+    std::vector<uint64_t> fired;
+    std::vector<bool> seen(expiries.size(), false);
+    uint64_t now = 1000;
+    while (wheel.size() != 0)
+    {
+        now += next() % 3 == 0 ? next() % 10000000 : next() % 50;
+        fired.clear();
+        wheel.advance(now, fired);
+        for (uint64_t id : fired)
+        {
+            assert(!seen[id - 1] && expiries[id - 1] <= now);
+            seen[id - 1] = true;
+        }
+        for (size_t i = 0; i < expiries.size(); ++i)
+        {
+            assert(seen[i] || expiries[i] > now);
+        }
+    }
+
+    OrderBook book;
+    book.setCloseTime(100);
+    book.addOffer(Offer{1, 1, 100, Price{1, 1}}, 110);
+    book.addOffer(Offer{2, 2, 100, Price{1, 1}});
+    book.addOffer(Offer{3, 3, 100, Price{2, 1}}, 120);
+    book.addOffer(Offer{4, 4, 100, Price{3, 1}}, 150);
+
+    // Offer 1 expires: it is skipped at once, and removed by crossing.
+    book.setCloseTime(110);
+    assert(book.isExpired(1) && !book.isExpired(2));
+    Offer best;
+    assert(book.loadBestOffer(best) && best.offerID == 2);
+    assert(book.size() == 4);
+    int64_t sheepSend, wheatReceived;
+    std::vector<ClaimAtom> trail;
+    convertWithOffers(book, INT64_MAX, sheepSend, 50, wheatReceived,
+                      RoundingType::NORMAL, nullptr, trail, INT64_MAX);
+    assert(trail.size() == 1 && trail[0].offerID == 2);
+    assert(book.size() == 3 && book.totalDepth() == 250);
+
+    // Offer 3 moves to a new price but keeps its expiry; a batch between
+    // ledgers then removes it without any crossing.
+    assert(book.amendOffer(3, 80, Price{5, 2}));
+    book.setCloseTime(130);
+    assert(book.expireOffers() == 1);
+    Offer offer;
+    assert(!book.loadOffer(3, offer));
+    assert(book.size() == 2 && book.totalDepth() == 150);
+
+    // Stale wheel entries of removed offers are ignored.
+    book.eraseOffer(4);
+    book.setCloseTime(200);
+    assert(book.expireOffers() == 0);
+    assert(book.size() == 1);
+
+    bool threw = false;
+    try
+    {
+        book.addOffer(Offer{5, 5, 10, Price{1, 1}}, 200);
+    }
+    catch (std::runtime_error&)
+    {
+        threw = true;
+    }
+    assert(threw);
+}
+
+// SECTION("Compaction repacks levels without changing the book")
+void testOrderBookCompaction() {
+    OrderBook book;
+    Rng next{31337};
+    int64_t const numOffers = 50000;
+    for (int64_t id = 1; id <= numOffers; ++id)
+    {
+        book.addOffer(Offer{(AccountID)(id % 13), id, next() % 1000 + 1,
+                            Price{(int32_t)(next() % 200 + 1), 100}});
+    }
+    // Churn: cancel most offers, leaving tombstones and oversized arrays.
+    for (int64_t id = 1; id <= numOffers; ++id)
+    {
+        if (next() % 10 != 0)
+        {
+            book.eraseOffer(id);
+        }
+    }
+    std::vector<DepthLevel> before;
+    book.getDepth(before, SIZE_MAX);
+    OrderBook reference = book;
+
+    size_t usage = book.memoryUsage();
+    size_t reclaimed = 0;
+    for (int call = 0; call < 200; ++call)
+    {
+        reclaimed += book.compact(1000);
+    }
+    assert(reclaimed > 0);
+    assert(book.memoryUsage() == usage - reclaimed);
+    // Another pass finds nothing left to do.
+    assert(book.compact(SIZE_MAX) == 0);
+
+    std::vector<DepthLevel> after;
+    book.getDepth(after, SIZE_MAX);
+    assert(after.size() == before.size());
+    for (size_t i = 0; i < after.size(); ++i)
+    {
+        assert(after[i].amount == before[i].amount &&
+               after[i].numOffers == before[i].numOffers);
+    }
+
+    // Handles were rebuilt: every lookup and cancel still works, and the
+    // crossing order is the same.
+    for (int64_t id = 1; id <= numOffers; ++id)
+    {
+        Offer a, b;
+        bool found = reference.loadOffer(id, a);
+        assert(book.loadOffer(id, b) == found);
+        assert(!found || (a.amount == b.amount && a.sellerID == b.sellerID));
+    }
+    int64_t sheepA, wheatA, sheepB, wheatB;
+    std::vector<ClaimAtom> trailA, trailB;
+    convertWithOffers(book, INT64_MAX, sheepA, 200000, wheatA,
+                      RoundingType::NORMAL, nullptr, trailA, INT64_MAX);
+    convertWithOffers(reference, INT64_MAX, sheepB, 200000, wheatB,
+                      RoundingType::NORMAL, nullptr, trailB, INT64_MAX);
+    assert(trailA.size() == trailB.size() && sheepA == sheepB);
+    for (size_t i = 0; i < trailA.size(); ++i)
+    {
+        assert(trailA[i].offerID == trailB[i].offerID);
+    }
+    for (int64_t id = 1; id <= numOffers; id += 3)
+    {
+        book.eraseOffer(id);
+    }
+    book.addOffer(Offer{1, numOffers + 1, 10, Price{1, 100}});
+    Offer best;
+    assert(book.loadBestOffer(best) && best.offerID == numOffers + 1);
+}
+
+// SECTION("Registry interns assets and finds books by pair")
+void testBookRegistry() {
+    BookRegistry registry;
+    Asset xlm = makeNativeAsset();
+    Asset usd = makeAsset("USD", 7);
+    Asset usdOther = makeAsset("USD", 8);
+    Asset longCode = makeAsset("LONGCODE1234", 7);
+    assert(usd.type == ASSET_TYPE_CREDIT_ALPHANUM4);
+    assert(longCode.type == ASSET_TYPE_CREDIT_ALPHANUM12);
+    assert(usd != usdOther && usd == makeAsset("USD", 7));
+
+    // Dense IDs from 1, stable on re-interning.
+    AssetID a = registry.intern(xlm);
+    AssetID b = registry.intern(usd);
+    AssetID c = registry.intern(usdOther);
+    assert(a == 1 && b == 2 && c == 3);
+    assert(registry.intern(makeAsset("USD", 7)) == b);
+    assert(registry.find(longCode) == 0);
+    assert(registry.asset(c) == usdOther);
+
+    // Books are per ordered pair and created on first use.
+    assert(registry.findBook(a, b) == nullptr);
+    OrderBook& ab = registry.book(a, b);
+    OrderBook& ba = registry.book(b, a);
+    assert(&ab != &ba && registry.numBooks() == 2);
+    ab.addOffer(Offer{1, 1, 100, Price{1, 1}});
+    for (AssetID x = 4; x < 200; ++x)
+    {
+        registry.intern(makeAsset("A" + std::to_string(x), x));
+        registry.book(x, a);
+    }
+    assert(registry.findBook(a, b) == &ab);
+    assert(registry.findBook(a, b)->size() == 1);
+    assert(registry.findBook(b, c) == nullptr);
+
+    bool threw = false;
+    try
+    {
+        makeAsset("BAD-CODE", 1);
+    }
+    catch (std::runtime_error&)
+    {
+        threw = true;
+    }
+    assert(threw);
+}
+
+static std::string
+toHex(Hash const& h)
+{
+    static char const* digits = "0123456789abcdef";
+    std::string s;
+    for (uint8_t b : h)
+    {
+        s += digits[b >> 4];
+        s += digits[b & 15];
+    }
+    return s;
+}
+
+// SECTION("Pool IDs hash the ordered pair and are cached per pair")
+void testPoolID() {
+    auto hashString = [](std::string const& s) {
+        return toHex(sha256((uint8_t const*)s.data(), s.size()));
+    };
+    assert(hashString("") == "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934c"
+                            "a495991b7852b855");
+    assert(hashString("abc") == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9c"
+                               "b410ff61f20015ad");
+    assert(hashString("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq") ==
+           "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+
+    // Whatever sha256 dispatches to agrees with the portable code across
+    // every padding case.
+    std::vector<uint8_t> data(300);
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        data[i] = (uint8_t)(i * 131 + 7);
+    }
+    for (size_t len = 0; len <= data.size(); ++len)
+    {
+        assert(sha256(data.data(), len) == sha256Portable(data.data(), len));
+    }
+
+    Asset xlm = makeNativeAsset();
+    Asset usd = makeAsset("USD", 7);
+    Asset eur = makeAsset("EUR", 7);
+    assert(xlm < usd && eur < usd && !(usd < eur));
+    PoolID id = getPoolID(xlm, usd, LIQUIDITY_POOL_FEE_V18);
+    assert(id == getPoolID(usd, xlm, LIQUIDITY_POOL_FEE_V18));
+    assert(id != getPoolID(xlm, usd, 10));
+    assert(id != getPoolID(xlm, eur, LIQUIDITY_POOL_FEE_V18));
+    bool threw = false;
+    try
+    {
+        getPoolID(usd, usd, LIQUIDITY_POOL_FEE_V18);
+    }
+    catch (std::runtime_error&)
+    {
+        threw = true;
+    }
+    assert(threw);
+
+    BookRegistry registry;
+    AssetID a = registry.intern(usd);
+    AssetID b = registry.intern(xlm);
+    assert(registry.poolID(a, b) == id && registry.poolID(b, a) == id);
+    assert(registry.numPools() == 0);
+    bool xIsA = true;
+    assert(registry.findPool(a, b, xIsA) == nullptr);
+    LiquidityPool& pool = registry.pool(a, b, xIsA);
+    assert(!xIsA && pool.feeBps == LIQUIDITY_POOL_FEE_V18);
+    pool.reserveA = 1000;
+    assert(registry.findPool(b, a, xIsA) == &pool && xIsA);
+    assert(&registry.pool(b, a, xIsA) == &pool && registry.numPools() == 1);
+}
+
+// SECTION("Path payments chain conversions and touch nothing on failure")
+void testPathPayment() {
+    // Assets 1..4; every adjacent pair has books both ways, B/C also a pool.
+    auto setUp = [](BookRegistry& registry) {
+        for (AccountID issuer = 1; issuer <= 4; ++issuer)
+        {
+            registry.intern(makeAsset("T" + std::to_string(issuer), issuer));
+        }
+        Rng next{4242};
+        int64_t offerID = 0;
+        for (AssetID x = 1; x < 4; ++x)
+        {
+            for (int side = 0; side < 2; ++side)
+            {
+                OrderBook& book = side ? registry.book(x, x + 1)
+                                       : registry.book(x + 1, x);
+                for (int i = 0; i < 30; ++i)
+                {
+                    Price price{(int32_t)(90 + next() % 30),
+                                (int32_t)(90 + next() % 30)};
+                    int64_t amount =
+                        adjustOffer(price, 50 + next() % 500, INT64_MAX);
+                    if (amount > 0)
+                    {
+                        book.addOffer(
+                            Offer{100 + (AccountID)(next() % 5), ++offerID,
+                                  amount, price});
+                    }
+                }
+            }
+        }
+        bool xIsA;
+        LiquidityPool& pool = registry.pool(3, 4, xIsA);
+        pool.reserveA = 40000;
+        pool.reserveB = 40000;
+    };
+    auto sameState = [](BookRegistry& a, BookRegistry& b) {
+        for (AssetID x = 1; x <= 4; ++x)
+        {
+            for (AssetID y = 1; y <= 4; ++y)
+            {
+                OrderBook* ba = a.findBook(x, y);
+                OrderBook* bb = b.findBook(x, y);
+                assert((ba == nullptr) == (bb == nullptr));
+                if (!ba)
+                {
+                    continue;
+                }
+                assert(ba->size() == bb->size());
+                for (int64_t id = 1; id <= 200; ++id)
+                {
+                    Offer oa, ob;
+                    bool ha = ba->loadOffer(id, oa);
+                    assert(ha == bb->loadOffer(id, ob));
+                    assert(!ha || oa.amount == ob.amount);
+                }
+            }
+        }
+        bool xIsA;
+        LiquidityPool* pa = a.findPool(3, 4, xIsA);
+        LiquidityPool* pb = b.findPool(3, 4, xIsA);
+        assert(pa->reserveA == pb->reserveA && pa->reserveB == pb->reserveB);
+    };
+    // Reference: live conversions hop by hop, in the order they are quoted.
+    auto reference = [](BookRegistry& registry, std::vector<AssetID> path,
+                        int64_t amount, bool strictSend) {
+        size_t hops = path.size() - 1;
+        for (size_t k = 0; k < hops; ++k)
+        {
+            size_t from = strictSend ? k : hops - 1 - k;
+            AssetID sheep = path[from];
+            AssetID wheat = path[from + 1];
+            if (sheep == wheat)
+            {
+                continue;
+            }
+            bool sheepIsA = false;
+            LiquidityPool* pool = registry.findPool(sheep, wheat, sheepIsA);
+            int64_t sheepSend, wheatReceived;
+            std::vector<ClaimAtom> trail;
+            auto res = convertWithOffersAndPools(
+                registry.book(wheat, sheep), pool, sheepIsA,
+                strictSend ? amount : INT64_MAX, sheepSend,
+                strictSend ? INT64_MAX : amount, wheatReceived,
+                strictSend ? RoundingType::PATH_PAYMENT_STRICT_SEND
+                           : RoundingType::PATH_PAYMENT_STRICT_RECEIVE,
+                nullptr, trail, 1000);
+            assert(res == ConvertResult::eOK);
+            amount = strictSend ? wheatReceived : sheepSend;
+        }
+        return amount;
+    };
+
+    std::vector<std::vector<AssetID>> paths = {
+        {1, 2}, {1, 2, 3, 4}, {4, 3, 2, 1}, {1, 2, 1, 2}, {3, 4, 3, 4, 3},
+        {1, 2, 2, 3}};
+    for (auto const& path : paths)
+    {
+        for (int strictSend = 0; strictSend < 2; ++strictSend)
+        {
+            BookRegistry registry, expected;
+            setUp(registry);
+            setUp(expected);
+            PathPayment payment(registry, 1000);
+            int64_t amount = 0;
+            auto res =
+                strictSend
+                    ? payment.strictSend(1, path.data(), path.size(), 700, 1,
+                                         amount)
+                    : payment.strictReceive(1, path.data(), path.size(),
+                                            INT64_MAX, 700, amount);
+            assert(res == PathPayment::Result::eSuccess);
+            assert(amount == reference(expected, path, 700, strictSend));
+            assert(!payment.offerTrail().empty());
+            sameState(registry, expected);
+        }
+    }
+
+    // Failures leave everything as it was.
+    BookRegistry registry, untouched;
+    setUp(registry);
+    setUp(untouched);
+    PathPayment payment(registry, 1000);
+    AssetID path[] = {1, 2, 3, 4};
+    int64_t amount;
+    assert(payment.strictSend(1, path, 4, 700, INT64_MAX, amount) ==
+           PathPayment::Result::eUnderDestMin);
+    assert(payment.strictReceive(1, path, 4, 1, 700, amount) ==
+           PathPayment::Result::eOverSendMax);
+    assert(payment.strictSend(1, path, 4, 100000000, 1, amount) ==
+           PathPayment::Result::eTooFewOffers);
+    Offer best;
+    assert(registry.findBook(2, 1)->loadBestOffer(best));
+    assert(payment.strictSend(best.sellerID, path, 4, 700, 1, amount) ==
+           PathPayment::Result::eOfferCrossSelf);
+    PathPayment limited(registry, 1);
+    assert(limited.strictSend(1, path, 4, 5000, 1, amount) ==
+           PathPayment::Result::eCrossedTooMany);
+    AssetID longPath[] = {1, 2, 1, 2, 1, 2, 1, 2};
+    assert(payment.strictSend(1, longPath, 8, 700, 1, amount) ==
+           PathPayment::Result::eMalformed);
+    assert(payment.strictSend(1, path, 4, 0, 1, amount) ==
+           PathPayment::Result::eMalformed);
+    assert(payment.offerTrail().empty());
+    sameState(registry, untouched);
+
+    // A strict receive is quoted backward but reported in path order.
+    MarketDataFeed feed(1024);
+    registry.findBook(2, 1)->setMarketDataFeed(&feed);
+    registry.findBook(3, 2)->setMarketDataFeed(&feed);
+    assert(payment.strictReceive(1, path, 4, INT64_MAX, 700, amount) ==
+           PathPayment::Result::eSuccess);
+    auto const& trail = payment.offerTrail();
+    Offer offer;
+    assert(untouched.findBook(2, 1)->loadOffer(trail.front().offerID, offer));
+    assert(trail.back().offerID == 0 ||
+           untouched.findBook(4, 3)->loadOffer(trail.back().offerID, offer));
+    MarketDataEvent event;
+    int64_t lastOfferID = 0;
+    for (uint64_t seq = 1; seq < feed.nextSequence(); ++seq)
+    {
+        assert(feed.read(seq, event) == MarketDataFeed::ReadResult::eOK);
+        if (event.type == MarketDataEventType::TRADE)
+        {
+            lastOfferID = event.offerID;
+            if (seq == 1)
+            {
+                assert(untouched.findBook(2, 1)->loadOffer(event.offerID,
+                                                           offer));
+            }
+        }
+    }
+    assert(untouched.findBook(3, 2)->loadOffer(lastOfferID, offer));
+}
+
+// SECTION("Path search finds the best simple paths")
+void testPathFinder() {
+    BookRegistry registry;
+    AssetID const numAssets = 7;
+    for (AccountID issuer = 1; issuer <= numAssets; ++issuer)
+    {
+        registry.intern(makeAsset("P" + std::to_string(issuer), issuer));
+    }
+    Rng next{99};
+    int64_t offerID = 0;
+    for (AssetID x = 1; x <= numAssets; ++x)
+    {
+        for (AssetID y = 1; y <= numAssets; ++y)
+        {
+            if (x == y || next() % 3 == 0)
+            {
+                continue;
+            }
+            OrderBook& book = registry.book(x, y);
+            for (int i = 0; i < 10; ++i)
+            {
+                Price price{(int32_t)(80 + next() % 40),
+                            (int32_t)(80 + next() % 40)};
+                int64_t amount =
+                    adjustOffer(price, 100 + next() % 2000, INT64_MAX);
+                if (amount > 0)
+                {
+                    book.addOffer(Offer{5, ++offerID, amount, price});
+                }
+            }
+            if (x < y && next() % 2 == 0)
+            {
+                bool xIsA;
+                LiquidityPool& pool = registry.pool(x, y, xIsA);
+                pool.reserveA = 5000 + next() % 50000;
+                pool.reserveB = 5000 + next() % 50000;
+            }
+        }
+    }
+
+    // Brute force over every simple path.
+    std::vector<ClaimAtom> trail;
+    std::vector<int64_t> amounts;
+    std::function<void(std::vector<AssetID>&, int64_t, AssetID, size_t)>
+        walk = [&](std::vector<AssetID>& path, int64_t amount, AssetID dest,
+                   size_t hopsLeft) {
+            if (path.back() == dest)
+            {
+                amounts.push_back(amount);
+                return;
+            }
+            if (hopsLeft == 0)
+            {
+                return;
+            }
+            for (AssetID to = 1; to <= numAssets; ++to)
+            {
+                if (std::find(path.begin(), path.end(), to) != path.end())
+                {
+                    continue;
+                }
+                bool sheepIsA = false;
+                LiquidityPool const* pool =
+                    ((BookRegistry const&)registry)
+                        .findPool(path.back(), to, sheepIsA);
+                OrderBook const* book = ((BookRegistry const&)registry)
+                                            .findBook(to, path.back());
+                if (!book && !pool)
+                {
+                    continue;
+                }
+                OrderBook empty;
+                LiquidityPool copy = pool ? *pool : LiquidityPool{0, 0, 0};
+                BookPosition position;
+                int64_t sheepSend, wheatReceived, lastAmount;
+                trail.clear();
+                auto res = quoteWithOffersAndPools(
+                    book ? *book : empty, position, pool ? &copy : nullptr,
+                    sheepIsA, amount, sheepSend, INT64_MAX, wheatReceived,
+                    RoundingType::PATH_PAYMENT_STRICT_SEND, nullptr, trail,
+                    1000, lastAmount);
+                if (res != ConvertResult::eOK || sheepSend != amount ||
+                    wheatReceived == 0)
+                {
+                    continue;
+                }
+                assert(pool || wheatReceived <= book->maxWheatForSheep(amount));
+                path.push_back(to);
+                walk(path, wheatReceived, dest, hopsLeft - 1);
+                path.pop_back();
+            }
+        };
+
+    PathFinder serial(registry, 64, 1);
+    PathFinder parallel(registry, 64, 3);
+    PathFinder narrow(registry, 1, 2);
+    for (AssetID dest = 2; dest <= numAssets; ++dest)
+    {
+        amounts.clear();
+        std::vector<AssetID> path{1};
+        walk(path, 3000, dest, 4);
+        std::sort(amounts.rbegin(), amounts.rend());
+
+        auto found = serial.findPaths(1, dest, 3000, 4, 3);
+        auto foundParallel = parallel.findPaths(1, dest, 3000, 4, 3);
+        assert(found.size() == std::min<size_t>(3, amounts.size()));
+        assert(foundParallel.size() == found.size());
+        for (size_t i = 0; i < found.size(); ++i)
+        {
+            assert(found[i].amount == amounts[i]);
+            assert(foundParallel[i].amount == amounts[i]);
+            assert(found[i].path[0] == 1 &&
+                   found[i].path[found[i].pathSize - 1] == dest);
+        }
+        auto best = narrow.findPaths(1, dest, 3000, 4, 1);
+        assert(best.size() <= 1);
+        assert(best.empty() || best[0].amount <= amounts[0]);
+    }
+
+    // The best path executes for exactly what it was quoted.
+    auto found = serial.findPaths(1, numAssets, 3000, 4, 1);
+    assert(!found.empty());
+    PathPayment payment(registry, 1000);
+    int64_t received;
+    assert(payment.strictSend(9, found[0].path.data(), found[0].pathSize, 3000,
+                              1, received) == PathPayment::Result::eSuccess);
+    assert(received == found[0].amount);
+}
+
+// SECTION("Dry-run quotes match crossing a copy and leave the book alone")
+void testQuoteWithOffers() {
+    Rng next{4242};
+    int64_t id = 0;
+    for (int round = 0; round < 100; ++round)
+    {
+        OrderBook book;
+        book.setCloseTime(100);
+        int offers = (int)(next() % 60);
+        for (int i = 0; i < offers; ++i)
+        {
+            Price price{(int32_t)(next() % 10 + 95), 100};
+            int64_t amount = adjustOffer(price, next() % 3000 + 1, INT64_MAX);
+            if (amount > 0)
+            {
+                // Some rounds have offers that expire before the quotes.
+                uint64_t expiry = round % 3 == 0 && next() % 4 == 0 ? 150 : 0;
+                book.addOffer(Offer{(AccountID)(next() % 3 + 1), ++id, amount,
+                                    price},
+                              expiry);
+            }
+        }
+        book.setCloseTime(200);
+        std::vector<DepthLevel> before, after;
+        book.getDepth(before, SIZE_MAX);
+
+        // A run of orders quoted back to back, each seeing the fills of the
+        // ones before, against a copy that crosses them for real.
+        OrderBook reference = book;
+        BookPosition position;
+        std::vector<ClaimAtom> trail, refTrail;
+        std::vector<std::pair<size_t, int64_t>> quotes; // trail end, last
+        for (int order = 0; order < 5; ++order)
+        {
+            RoundingType rt = next() % 2
+                                  ? RoundingType::NORMAL
+                                  : RoundingType::PATH_PAYMENT_STRICT_SEND;
+            int64_t maxSend = next() % 20000 + 1;
+            int64_t maxReceive =
+                rt == RoundingType::NORMAL ? next() % 20000 + 1 : INT64_MAX;
+            int64_t maxCross = next() % 30 + 1;
+            AccountID taker = (AccountID)(next() % 4 + 1);
+            Price limit{110, 100};
+            auto filter = order % 2 ? makeOfferFilter(book, taker, limit, false)
+                                    : nullptr;
+            auto refFilter =
+                order % 2 ? makeOfferFilter(reference, taker, limit, false)
+                          : nullptr;
+
+            int64_t sheepSend, wheatReceived, lastAmount;
+            size_t trailSize = trail.size();
+            auto res = quoteWithOffers(book, position, maxSend, sheepSend,
+                                       maxReceive, wheatReceived, rt, filter,
+                                       trail, trailSize + maxCross, lastAmount);
+            int64_t refSheep, refWheat;
+            size_t refSize = refTrail.size();
+            auto refRes = convertWithOffers(reference, maxSend, refSheep,
+                                            maxReceive, refWheat, rt, refFilter,
+                                            refTrail, refSize + maxCross);
+            assert(res == refRes);
+            assert(sheepSend == refSheep && wheatReceived == refWheat);
+            assert(trail.size() == refTrail.size());
+            for (size_t i = trailSize; i < trail.size(); ++i)
+            {
+                assert(trail[i].offerID == refTrail[i].offerID);
+                assert(trail[i].amountSold == refTrail[i].amountSold);
+                assert(trail[i].amountBought == refTrail[i].amountBought);
+            }
+            if (trail.size() != trailSize)
+            {
+                Offer left;
+                bool stays = reference.loadOffer(trail.back().offerID, left);
+                assert(lastAmount == (stays ? left.amount : 0));
+            }
+            quotes.emplace_back(trail.size(), lastAmount);
+        }
+
+        // Nothing moved, and committing the quotes in order gives the book
+        // the copy ended up with.
+        book.getDepth(after, SIZE_MAX);
+        assert(after.size() == before.size());
+        for (size_t i = 0; i < after.size(); ++i)
+        {
+            assert(after[i].amount == before[i].amount &&
+                   after[i].numOffers == before[i].numOffers);
+        }
+        size_t first = 0;
+        for (auto const& q : quotes)
+        {
+            commitQuote(book, trail, first, q.first, q.second);
+            first = q.first;
+        }
+        // The copy dropped the expired offers it ran into on the way.
+        book.expireOffers();
+        reference.expireOffers();
+        std::vector<DepthLevel> expected;
+        reference.getDepth(expected, SIZE_MAX);
+        book.getDepth(after, SIZE_MAX);
+        assert(after.size() == expected.size());
+        for (size_t i = 0; i < after.size(); ++i)
+        {
+            assert(after[i].amount == expected[i].amount &&
+                   after[i].numOffers == expected[i].numOffers);
+        }
+    }
+}
+
+// SECTION("Path quote cache serves repeats until a level it read changes")
+void testPathQuoteCache() {
+    BookRegistry registry;
+    AssetID const numAssets = 6;
+    for (AccountID issuer = 1; issuer <= numAssets; ++issuer)
+    {
+        registry.intern(makeAsset("Q" + std::to_string(issuer), issuer));
+    }
+    Rng next{31};
+    int64_t offerID = 0;
+    for (AssetID x = 1; x <= numAssets; ++x)
+    {
+        for (AssetID y = 1; y <= numAssets; ++y)
+        {
+            if (x == y)
+            {
+                continue;
+            }
+            OrderBook& book = registry.book(x, y);
+            for (int i = 0; i < 8; ++i)
+            {
+                Price price{(int32_t)(90 + next() % 30), 100};
+                book.addOffer(Offer{5, ++offerID,
+                                    adjustOffer(price, 200 + next() % 800,
+                                                INT64_MAX),
+                                    price});
+            }
+        }
+    }
+    BookRegistry const& reader = registry;
+    auto quoteAlong = [&reader](PathQuote const& p, int64_t amount) {
+        for (size_t i = 1; i < p.pathSize; ++i)
+        {
+            BookPosition position;
+            std::vector<ClaimAtom> trail;
+            int64_t sheepSend, received, lastAmount;
+            quoteWithOffers(*reader.findBook(p.path[i], p.path[i - 1]),
+                            position, amount, sheepSend, INT64_MAX, received,
+                            RoundingType::PATH_PAYMENT_STRICT_SEND, nullptr,
+                            trail, 1000, lastAmount);
+            amount = received;
+        }
+        return amount;
+    };
+    auto samePaths = [](std::vector<PathQuote> const& a,
+                        std::vector<PathQuote> const& b) {
+        if (a.size() != b.size())
+        {
+            return false;
+        }
+        for (size_t i = 0; i < a.size(); ++i)
+        {
+            if (a[i].amount != b[i].amount || a[i].pathSize != b[i].pathSize ||
+                !std::equal(a[i].path.begin(),
+                            a[i].path.begin() + a[i].pathSize,
+                            b[i].path.begin()))
+            {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    PathFinder finder(registry, 16, 1);
+    PathQuoteCache cache(registry, finder, 4);
+    auto first = cache.findPaths(1, numAssets, 3000, 3, 2);
+    assert(first.size() == 2);
+    assert(samePaths(first, finder.findPaths(1, numAssets, 3000, 3, 2)));
+    assert(samePaths(cache.findPaths(1, numAssets, 3000, 3, 2), first));
+    assert(cache.stats().searches == 1 && cache.stats().hits == 1);
+
+    // A book none of the paths crosses changes: still served.
+    AssetID unused = 0;
+    for (AssetID a = 2; a < numAssets && unused == 0; ++a)
+    {
+        bool used = false;
+        for (auto const& p : first)
+        {
+            used = used || std::find(p.path.begin(), p.path.begin() + p.pathSize,
+                                     a) != p.path.begin() + p.pathSize;
+        }
+        unused = used ? 0 : a;
+    }
+    assert(unused != 0);
+    OrderBook& other = registry.book(unused, 1);
+    Offer best;
+    assert(other.loadBestOffer(best));
+    other.setOfferAmount(best.offerID, best.amount / 2);
+    assert(samePaths(cache.findPaths(1, numAssets, 3000, 3, 2), first));
+    assert(cache.stats().hits == 2);
+
+    // Another amount in the same bucket quotes the stored paths again.
+    auto other3001 = cache.findPaths(1, numAssets, 3001, 3, 2);
+    assert(cache.stats().requotes == 1 && cache.stats().searches == 1);
+    assert(other3001.size() == 2);
+    for (auto const& p : other3001)
+    {
+        assert(p.amount == quoteAlong(p, 3001));
+    }
+
+    // Paying along the best path crosses levels its quote read.
+    PathPayment payment(registry, 1000);
+    int64_t received;
+    assert(payment.strictSend(9, other3001[0].path.data(),
+                              other3001[0].pathSize, 3001, 1, received) ==
+           PathPayment::Result::eSuccess);
+    auto after = cache.findPaths(1, numAssets, 3001, 3, 2);
+    assert(cache.stats().searches == 2);
+    assert(samePaths(after, finder.findPaths(1, numAssets, 3001, 3, 2)));
+
+    // A new pair drops everything.
+    registry.intern(makeAsset("Q7", 7));
+    registry.book(numAssets + 1, 1);
+    finder.rebuildGraph();
+    cache.findPaths(1, numAssets, 3001, 3, 2);
+    assert(cache.stats().searches == 3);
+}
+
+// SECTION("Arbitrage detector keeps exactly the profitable cycles")
+void testArbitrageDetector() {
+    BookRegistry registry;
+    AssetID const numAssets = 5;
+    std::vector<int32_t> value(numAssets + 1);
+    Rng next{17};
+    for (AccountID issuer = 1; issuer <= numAssets; ++issuer)
+    {
+        registry.intern(makeAsset("R" + std::to_string(issuer), issuer));
+        value[issuer] = (int32_t)(50 + next() % 150);
+    }
+    // Every book asks at least 0.1% over the fair rate: nothing to gain.
+    int64_t offerID = 0;
+    auto addOffer = [&](AssetID wheat, AssetID sheep, int32_t permille) {
+        Price price{value[wheat] * permille, value[sheep] * 1000};
+        int64_t amount = adjustOffer(price, 10000 + next() % 50000, INT64_MAX);
+        if (amount > 0)
+        {
+            registry.book(wheat, sheep)
+                .addOffer(Offer{1, ++offerID, amount, price});
+        }
+    };
+    for (AssetID x = 1; x <= numAssets; ++x)
+    {
+        for (AssetID y = 1; y <= numAssets; ++y)
+        {
+            for (int i = 0; x != y && i < 4; ++i)
+            {
+                addOffer(x, y, (int32_t)(1001 + next() % 30));
+            }
+        }
+    }
+    bool xIsA;
+    LiquidityPool& pool = registry.pool(1, 2, xIsA);
+    pool.reserveA = (xIsA ? value[2] : value[1]) * (int64_t)10000;
+    pool.reserveB = (xIsA ? value[1] : value[2]) * (int64_t)10000;
+
+    ArbitrageDetector detector(registry, 3);
+    detector.update();
+    assert(detector.opportunities().empty());
+
+    // The directed edges of a cycle, whichever asset it starts from.
+    auto edgesOf = [](Arbitrage const& a) {
+        std::vector<std::pair<AssetID, AssetID>> edges;
+        for (size_t i = 0; i < a.length; ++i)
+        {
+            edges.emplace_back(a.cycle[i], a.cycle[i + 1]);
+        }
+        std::sort(edges.begin(), edges.end());
+        return edges;
+    };
+    auto cyclesOf = [&](std::vector<Arbitrage> const& found) {
+        std::vector<std::vector<std::pair<AssetID, AssetID>>> cycles;
+        for (auto const& a : found)
+        {
+            assert(a.amountOut > a.amountIn && a.cycle[0] == a.cycle[a.length]);
+            cycles.push_back(edgesOf(a));
+        }
+        std::sort(cycles.begin(), cycles.end());
+        return cycles;
+    };
+
+    // Underpriced offers appear and get taken; the incremental result must
+    // always be what a detector starting from scratch finds.
+    int rounds = 0, withArbitrage = 0;
+    for (; rounds < 40; ++rounds)
+    {
+        AssetID wheat = (AssetID)(next() % numAssets + 1);
+        AssetID sheep = (AssetID)(next() % (numAssets - 1) + 1);
+        sheep += sheep >= wheat;
+        if (next() % 3 != 0)
+        {
+            addOffer(wheat, sheep, (int32_t)(960 + next() % 40));
+        }
+        else
+        {
+            OrderBook& book = registry.book(wheat, sheep);
+            int64_t sheepSend, wheatReceived;
+            std::vector<ClaimAtom> trail;
+            convertWithOffers(book, 30000, sheepSend, INT64_MAX,
+                              wheatReceived,
+                              RoundingType::PATH_PAYMENT_STRICT_SEND, nullptr,
+                              trail, 1000);
+        }
+        if (next() % 5 == 0)
+        {
+            pool.reserveA += next() % 2000;
+        }
+        detector.update();
+        ArbitrageDetector fresh(registry, 3);
+        fresh.update();
+        assert(cyclesOf(detector.opportunities()) ==
+               cyclesOf(fresh.opportunities()));
+        withArbitrage += !detector.opportunities().empty();
+    }
+    assert(withArbitrage > 0);
+
+    // Nothing changed: nothing moves.
+    auto before = cyclesOf(detector.opportunities());
+    detector.update();
+    assert(cyclesOf(detector.opportunities()) == before);
+
+    // A found cycle pays what it was verified for.
+    if (!detector.opportunities().empty())
+    {
+        Arbitrage a = detector.opportunities()[0];
+        PathPayment payment(registry, 1000);
+        int64_t received;
+        assert(payment.strictSend(99, a.cycle.data(), a.length + 1, a.amountIn,
+                                  a.amountIn + 1, received) ==
+               PathPayment::Result::eSuccess);
+        assert(received == a.amountOut);
+    }
+
+    // A cycle whose first hop gives less than 1 per unit: the smallest
+    // amounts get nothing out of it, and larger ones still profit.
+    BookRegistry pair;
+    AssetID a = pair.intern(makeAsset("A", 1));
+    AssetID b = pair.intern(makeAsset("B", 2));
+    pair.book(b, a).addOffer(Offer{7, 1, 1000000, Price{2, 1}});
+    pair.book(a, b).addOffer(Offer{8, 2, 1000000, Price{1, 3}});
+    ArbitrageDetector cycle(pair, 2);
+    cycle.update();
+    assert(cycle.opportunities().size() == 1);
+    Arbitrage const& found = cycle.opportunities()[0];
+    assert(found.length == 2 && found.amountOut > found.amountIn);
+    PathPayment payment(pair, 1000);
+    int64_t received;
+    assert(payment.strictSend(99, found.cycle.data(), 3, found.amountIn,
+                              found.amountIn + 1, received) ==
+           PathPayment::Result::eSuccess);
+    assert(received == found.amountOut);
+}
+
+// SECTION("Account store limits follow stellar's balances and liabilities")
+void testAccountStore() {
+    BookRegistry registry;
+    AssetID native = registry.intern(makeNativeAsset());
+    AssetID usd = registry.intern(makeAsset("USD", 100));
+    AssetID eur = registry.intern(makeAsset("EUR", 101));
+    int64_t const reserve = 5000000;
+    AccountStore store(registry, reserve);
+
+    store.createAccount(1, 1000 * reserve);
+    store.createAccount(100, 10 * reserve);
+    BalanceEntry& usdLine = store.createTrustLine(1, usd, 5000, AUTHORIZED_FLAG);
+    usdLine.balance = 3000;
+    store.createTrustLine(1, eur, 8000, 0);
+    assert(store.size() == 4);
+    assert((uintptr_t)store.findTrustLine(1, usd) % 64 == 0);
+    assert(store.findTrustLine(1, usd)->balance == 3000);
+    assert(!store.findTrustLine(2, usd) && !store.findTrustLine(100, usd));
+    assert(store.findAccount(1)->numSubEntries == 2);
+
+    // Native: above the reserve of 2 + 2 entries, less selling liabilities.
+    BalanceEntry* account = store.findAccount(1);
+    assert(canSellAtMost(store, 1, native) == 996 * reserve);
+    account->sellingLiabilities = 6 * reserve;
+    account->buyingLiabilities = 7;
+    assert(canSellAtMost(store, 1, native) == 990 * reserve);
+    assert(canBuyAtMost(store, 1, native) ==
+           INT64_MAX - 1000 * reserve - 7);
+    account->numSponsored = 1;
+    assert(canSellAtMost(store, 1, native) == 991 * reserve);
+    account->balance = reserve;
+    assert(canSellAtMost(store, 1, native) == 0);
+
+    // Trustlines: balance less selling liabilities, limit less balance and
+    // buying liabilities.
+    store.findTrustLine(1, usd)->sellingLiabilities = 500;
+    store.findTrustLine(1, usd)->buyingLiabilities = 1200;
+    assert(canSellAtMost(store, 1, usd) == 2500);
+    assert(canBuyAtMost(store, 1, usd) == 800);
+    store.findTrustLine(1, usd)->buyingLiabilities = 2500;
+    assert(canBuyAtMost(store, 1, usd) == 0);
+
+    // Unauthorized lines can neither sell nor buy; lines authorized to
+    // maintain liabilities can still sell.
+    BalanceEntry* eurLine = store.findTrustLine(1, eur);
+    eurLine->balance = 400;
+    assert(canSellAtMost(store, 1, eur) == 0);
+    assert(canBuyAtMost(store, 1, eur) == 0);
+    eurLine->flags = AUTHORIZED_TO_MAINTAIN_LIABILITIES_FLAG;
+    assert(canSellAtMost(store, 1, eur) == 400);
+    assert(canBuyAtMost(store, 1, eur) == 0);
+
+    // Issuers are unlimited in their own asset; strangers get nothing.
+    assert(canSellAtMost(store, 100, usd) == INT64_MAX);
+    assert(canBuyAtMost(store, 100, usd) == INT64_MAX);
+    assert(canSellAtMost(store, 2, usd) == 0);
+    assert(canBuyAtMost(store, 2, native) == 0);
+
+    // Based on sheep: the wheat worth what the sheep line can still take.
+    store.findTrustLine(1, usd)->buyingLiabilities = 1200;
+    assert(canSellAtMostBasedOnSheep(store, 1, usd, Price{3, 2}) == 533);
+    assert(canSellAtMostBasedOnSheep(store, 1, native, Price{3, 2}) ==
+           INT64_MAX);
+    assert(canSellAtMostBasedOnSheep(store, 100, usd, Price{1, 2}) ==
+           INT64_MAX);
+    assert(canSellAtMostBasedOnSheep(store, 2, usd, Price{1, 2}) == 0);
+
+    bool threw = false;
+    try
+    {
+        store.createTrustLine(1, usd, 10, AUTHORIZED_FLAG);
+    }
+    catch (std::runtime_error&)
+    {
+        threw = true;
+    }
+    assert(threw);
+    threw = false;
+    try
+    {
+        store.createTrustLine(100, usd, 10, AUTHORIZED_FLAG);
+    }
+    catch (std::runtime_error&)
+    {
+        threw = true;
+    }
+    assert(threw);
+}
+
+// SECTION("Liabilities follow every change to the offers in attached books")
+void testOfferLiabilities() {
+    BookRegistry registry;
+    AssetID native = registry.intern(makeNativeAsset());
+    AssetID usd = registry.intern(makeAsset("USD", 100));
+    AssetID eur = registry.intern(makeAsset("EUR", 101));
+    AccountStore store(registry);
+    for (AccountID account = 1; account <= 4; ++account)
+    {
+        store.createAccount(account, 1000000000);
+        store.createTrustLine(account, usd, INT64_MAX, AUTHORIZED_FLAG);
+        store.createTrustLine(account, eur, INT64_MAX, AUTHORIZED_FLAG);
+    }
+    store.createAccount(100, 1000000000);
+    store.setCheckLiabilities(true);
+
+    // Offers placed before attaching count once attached.
+    OrderBook& usdForNative = registry.book(usd, native);
+    usdForNative.addOffer(Offer{1, 1, 1000, Price{3, 2}});
+    assert(store.findTrustLine(1, usd)->sellingLiabilities == 0);
+    registry.setAccountStore(&store);
+    assert(store.findTrustLine(1, usd)->sellingLiabilities == 1000);
+    assert(store.findAccount(1)->buyingLiabilities == 1500);
+
+    // A fill, an amend in place and a cancel each move them by the
+    // difference.
+    int64_t sheepSend, wheatReceived;
+    std::vector<ClaimAtom> trail;
+    convertWithOffers(usdForNative, 600, sheepSend, INT64_MAX, wheatReceived,
+                      RoundingType::NORMAL, nullptr, trail, 1000);
+    assert(wheatReceived == 400);
+    assert(store.findTrustLine(1, usd)->sellingLiabilities == 600);
+    assert(store.findAccount(1)->buyingLiabilities == 900);
+    usdForNative.amendOffer(1, 800, Price{6, 4});
+    assert(store.findTrustLine(1, usd)->sellingLiabilities == 800);
+    usdForNative.amendOffer(1, 800, Price{2, 1});
+    assert(store.findAccount(1)->buyingLiabilities == 1600);
+    usdForNative.eraseOffer(1);
+    assert(store.findTrustLine(1, usd)->sellingLiabilities == 0);
+    assert(store.findAccount(1)->buyingLiabilities == 0);
+
+    // Issuers commit nothing.
+    OrderBook& eurForUsd = registry.book(eur, usd);
+    eurForUsd.addOffer(Offer{101, 2, 500, Price{1, 1}});
+    eurForUsd.addOffer(Offer{100, 3, 500, Price{1, 1}});
+    assert(store.findAccount(100)->sellingLiabilities == 0);
+    assert(store.findTrustLine(100, usd) == nullptr);
+
+    // A market maker with many offers on every book, crossed, amended,
+    // expired and quoted against; the full recompute runs after each
+    // change.
+    Rng next{5};
+    AssetID assets[] = {native, usd, eur};
+    int64_t offerID = 10;
+    for (int i = 0; i < 300; ++i)
+    {
+        AssetID wheat = assets[next() % 3];
+        AssetID sheep = assets[next() % 3];
+        if (wheat == sheep)
+        {
+            continue;
+        }
+        OrderBook& book = registry.book(wheat, sheep);
+        Price price{(int32_t)(90 + next() % 20), 100};
+        int64_t amount = adjustOffer(price, 1 + next() % 5000, INT64_MAX);
+        switch (next() % 6)
+        {
+        case 0:
+        case 1:
+            if (amount > 0)
+            {
+                book.addOffer(Offer{(AccountID)(1 + next() % 4), ++offerID,
+                                    amount, price},
+                              next() % 4 == 0 ? book.closeTime() + 5 : 0);
+            }
+            break;
+        case 2:
+        {
+            trail.clear();
+            convertWithOffers(book, 1 + next() % 20000, sheepSend, INT64_MAX,
+                              wheatReceived,
+                              RoundingType::PATH_PAYMENT_STRICT_SEND, nullptr,
+                              trail, 1000);
+            break;
+        }
+        case 3:
+        {
+            Offer best;
+            if (book.loadBestOffer(best))
+            {
+                book.amendOffer(best.offerID, amount, price);
+            }
+            break;
+        }
+        case 4:
+        {
+            BookPosition position;
+            int64_t lastAmount;
+            trail.clear();
+            quoteWithOffers(book, position, 1 + next() % 20000, sheepSend,
+                            INT64_MAX, wheatReceived, RoundingType::NORMAL,
+                            nullptr, trail, 1000, lastAmount);
+            commitQuote(book, trail, 0, trail.size(), lastAmount);
+            break;
+        }
+        default:
+            book.setCloseTime(book.closeTime() + 1);
+            if (next() % 2 == 0)
+            {
+                book.expireOffers();
+            }
+            break;
+        }
+    }
+    store.checkLiabilities();
+    int64_t committed = 0;
+    for (AccountID account = 1; account <= 4; ++account)
+    {
+        committed += store.findAccount(account)->sellingLiabilities +
+                     store.findTrustLine(account, usd)->buyingLiabilities;
+    }
+    assert(committed > 0);
+
+    // Drift is caught.
+    store.setCheckLiabilities(false);
+    store.findAccount(1)->sellingLiabilities += 1;
+    bool threw = false;
+    try
+    {
+        store.checkLiabilities();
+    }
+    catch (std::runtime_error&)
+    {
+        threw = true;
+    }
+    assert(threw);
+    store.findAccount(1)->sellingLiabilities -= 1;
+
+    // Detaching takes everything back out.
+    registry.setAccountStore(nullptr);
+    for (AccountID account = 1; account <= 4; ++account)
+    {
+        for (AssetID asset : assets)
+        {
+            BalanceEntry const* entry = asset == native
+                                            ? store.findAccount(account)
+                                            : store.findTrustLine(account,
+                                                                  asset);
+            assert(entry->buyingLiabilities == 0 &&
+                   entry->sellingLiabilities == 0);
+        }
+    }
+
+    // An amend the depth cannot take leaves the liabilities alone.
+    BookRegistry other;
+    AssetID otherNative = other.intern(makeNativeAsset());
+    AssetID otherUsd = other.intern(makeAsset("USD", 100));
+    AccountStore otherStore(other);
+    for (AccountID account = 1; account <= 2; ++account)
+    {
+        otherStore.createAccount(account, 1000000000);
+        otherStore.createTrustLine(account, otherUsd, INT64_MAX,
+                                   AUTHORIZED_FLAG);
+    }
+    otherStore.setCheckLiabilities(true);
+    other.setAccountStore(&otherStore);
+    OrderBook& full = other.book(otherUsd, otherNative);
+    full.addOffer(Offer{1, 1, 1000, Price{1, 1}});
+    full.addOffer(Offer{2, 2, INT64_MAX - 2000, Price{1, 1}});
+    threw = false;
+    try
+    {
+        full.amendOffer(1, 3000, Price{1, 1});
+    }
+    catch (std::overflow_error&)
+    {
+        threw = true;
+    }
+    assert(threw);
+    assert(otherStore.findTrustLine(1, otherUsd)->sellingLiabilities == 1000);
+    otherStore.checkLiabilities();
+
+    // Neither can a change the liabilities cannot take: buying XLM through
+    // two books, one seller is a few stroops short of INT64_MAX. Adding,
+    // filling up, amending in place and re-pricing all throw and leave the
+    // books and the store as they were.
+    AssetID otherEur = other.intern(makeAsset("EUR", 101));
+    otherStore.createTrustLine(1, otherEur, INT64_MAX, AUTHORIZED_FLAG);
+    OrderBook& usdBook = other.book(otherUsd, otherNative);
+    OrderBook& eurBook = other.book(otherEur, otherNative);
+    usdBook.eraseOffer(1);
+    usdBook.eraseOffer(2);
+    usdBook.setCloseTime(10);
+    usdBook.addOffer(Offer{1, 3, 5, Price{1, 1}}, 20);
+    eurBook.addOffer(Offer{1, 4, INT64_MAX - 10, Price{1, 1}});
+    auto throwsOverflow = [](std::function<void()> change) {
+        try
+        {
+            change();
+        }
+        catch (std::overflow_error&)
+        {
+            return true;
+        }
+        return false;
+    };
+    assert(throwsOverflow(
+        [&]() { usdBook.addOffer(Offer{1, 5, 100, Price{1, 1}}); }));
+    assert(throwsOverflow([&]() { usdBook.setOfferAmount(3, 100); }));
+    assert(throwsOverflow([&]() { usdBook.amendOffer(3, 100, Price{1, 1}); }));
+    assert(throwsOverflow([&]() { usdBook.amendOffer(3, 100, Price{2, 1}); }));
+    Offer kept;
+    assert(!usdBook.loadOffer(5, kept));
+    assert(usdBook.loadOffer(3, kept) && kept.amount == 5 &&
+           kept.price.n == 1 && kept.price.d == 1);
+    std::vector<DepthLevel> usdDepth;
+    usdBook.getDepth(usdDepth, SIZE_MAX);
+    assert(usdDepth.size() == 1 && usdDepth[0].amount == 5 &&
+           usdDepth[0].numOffers == 1);
+    assert(otherStore.findTrustLine(1, otherUsd)->sellingLiabilities == 5);
+    assert(otherStore.findAccount(1)->buyingLiabilities == INT64_MAX - 5);
+    otherStore.checkLiabilities();
+    usdBook.setCloseTime(20);
+    assert(usdBook.expireOffers() == 1);
+    assert(otherStore.findAccount(1)->buyingLiabilities == INT64_MAX - 10);
+}
+
+// SECTION("Batch auction clears both books at one price")
+void testBatchAuction() {
+    {
+        OrderBook asks, bids;
+        asks.addOffer(Offer{1, 1, 100, Price{1, 1}});
+        asks.addOffer(Offer{2, 2, 100, Price{3, 2}});
+        asks.addOffer(Offer{3, 3, 100, Price{5, 2}});
+        // Bids sell sheep; 300 sheep for wheat at up to 2, 50 at up to 1.
+        bids.addOffer(Offer{4, 4, 300, Price{1, 2}});
+        bids.addOffer(Offer{5, 5, 50, Price{1, 1}});
+
+        // 1 trades 100, 3/2 trades 200 exactly, 2 only 150.
+        Price price;
+        std::vector<AuctionMatch> matches;
+        assert(clearBatchAuction(asks, bids, price, matches));
+        assert(price.n == 3 && price.d == 2);
+        assert(matches.size() == 2);
+        assert(matches[0].askOfferID == 1 && matches[0].bidOfferID == 4 &&
+               matches[0].wheat == 100 && matches[0].sheep == 150);
+        assert(matches[1].askOfferID == 2 && matches[1].bidOfferID == 4 &&
+               matches[1].wheat == 100 && matches[1].sheep == 150);
+        assert(asks.size() == 1 && bids.size() == 1);
+        Offer left;
+        assert(bids.loadOffer(5, left) && left.amount == 50);
+
+        // Uncrossed books do not clear.
+        matches.clear();
+        assert(!clearBatchAuction(asks, bids, price, matches));
+        assert(matches.empty());
+    }
+
+    // Random batches over a registry with liabilities checked after every
+    // change.
+    BookRegistry registry;
+    AssetID wheat = registry.intern(makeAsset("W", 100));
+    AssetID sheep = registry.intern(makeAsset("S", 101));
+    AccountStore store(registry);
+    for (AccountID account = 1; account <= 8; ++account)
+    {
+        store.createAccount(account, 1000000000);
+        store.createTrustLine(account, wheat, INT64_MAX, AUTHORIZED_FLAG);
+        store.createTrustLine(account, sheep, INT64_MAX, AUTHORIZED_FLAG);
+    }
+    store.setCheckLiabilities(true);
+    registry.setAccountStore(&store);
+    OrderBook& asks = registry.book(wheat, sheep);
+    OrderBook& bids = registry.book(sheep, wheat);
+
+    Rng next{3};
+    auto cmp = [](Price const& a, Price const& b) {
+        int64_t l = (int64_t)a.n * b.d, r = (int64_t)b.n * a.d;
+        return l < r ? -1 : (l > r ? 1 : 0);
+    };
+    int64_t offerID = 0;
+    int cleared = 0;
+    for (int round = 0; round < 30; ++round)
+    {
+        for (int i = 0; i < 40; ++i)
+        {
+            bool isAsk = next() % 2 == 0;
+            Price price{(int32_t)(90 + next() % 25), 100};
+            if (!isAsk)
+            {
+                price = Price{price.d, price.n};
+            }
+            int64_t amount = adjustOffer(price, 1 + next() % 3000, INT64_MAX);
+            if (amount > 0)
+            {
+                (isAsk ? asks : bids)
+                    .addOffer(Offer{(AccountID)(1 + next() % 8), ++offerID,
+                                    amount, price});
+            }
+        }
+
+        // The price must trade the most wheat of all candidates.
+        std::vector<DepthLevel> askLevels, bidLevels;
+        asks.getDepth(askLevels, asks.numLevels());
+        bids.getDepth(bidLevels, bids.numLevels());
+        auto volumeAt = [&](Price const& p, int64_t& imbalance) {
+            int64_t supply = 0, demand = 0;
+            for (auto const& l : askLevels)
+            {
+                supply += cmp(l.price, p) <= 0 ? l.amount : 0;
+            }
+            for (auto const& l : bidLevels)
+            {
+                demand += cmp(Price{l.price.d, l.price.n}, p) >= 0 ? l.amount
+                                                                   : 0;
+            }
+            int64_t wheatDemand =
+                bigDivideOrThrow128(bigMultiply(demand, p.d), p.n, ROUND_DOWN);
+            imbalance = std::max(supply, wheatDemand) -
+                        std::min(supply, wheatDemand);
+            return std::min(supply, wheatDemand);
+        };
+        int64_t bestVolume = 0, imbalance;
+        std::vector<Price> candidates;
+        for (auto const& l : askLevels)
+        {
+            candidates.push_back(l.price);
+        }
+        for (auto const& l : bidLevels)
+        {
+            candidates.push_back(Price{l.price.d, l.price.n});
+        }
+        for (auto const& p : candidates)
+        {
+            bestVolume = std::max(bestVolume, volumeAt(p, imbalance));
+        }
+
+        std::map<int64_t, int64_t> before;
+        for (auto* book : {&asks, &bids})
+        {
+            book->forEachOffer(
+                [&](Offer const& o) { before[o.offerID] = o.amount; });
+        }
+        Price price;
+        std::vector<AuctionMatch> matches;
+        bool crossed = clearBatchAuction(asks, bids, price, matches);
+        assert(crossed == (bestVolume > 0));
+        if (!crossed)
+        {
+            continue;
+        }
+        ++cleared;
+        int64_t bestImbalance;
+        assert(volumeAt(price, bestImbalance) == bestVolume);
+        for (auto const& p : candidates)
+        {
+            assert(volumeAt(p, imbalance) < bestVolume ||
+                   imbalance >= bestImbalance);
+        }
+
+        // Every match is an exchangeV10 trade at the clearing price between
+        // orders willing to trade there, and the books lose exactly what was
+        // traded (less whatever adjustOffer trims off what stays).
+        std::map<int64_t, int64_t> sold;
+        for (auto const& m : matches)
+        {
+            assert(checkPriceErrorBound(price, m.wheat, m.sheep, false));
+            sold[m.askOfferID] += m.wheat;
+            sold[m.bidOfferID] += m.sheep;
+        }
+        for (auto const& entry : sold)
+        {
+            Offer o;
+            int64_t left = entry.second <= before[entry.first]
+                               ? before[entry.first] - entry.second
+                               : -1;
+            assert(left >= 0);
+            if (asks.loadOffer(entry.first, o))
+            {
+                assert(cmp(o.price, price) <= 0 && o.amount <= left &&
+                       o.amount == adjustOffer(o.price, left, INT64_MAX));
+            }
+            else if (bids.loadOffer(entry.first, o))
+            {
+                assert(cmp(Price{o.price.d, o.price.n}, price) >= 0 &&
+                       o.amount == adjustOffer(o.price, left, INT64_MAX));
+            }
+        }
+        // What is left either does not reach the clearing price or is too
+        // small to trade at it.
+        Offer bestAsk, bestBid;
+        if (asks.loadBestOffer(bestAsk) && bids.loadBestOffer(bestBid) &&
+            cmp(bestAsk.price, price) <= 0 &&
+            cmp(Price{bestBid.price.d, bestBid.price.n}, price) >= 0)
+        {
+            auto res = exchangeV10(price, bestAsk.amount, INT64_MAX,
+                                   bestBid.amount, INT64_MAX,
+                                   RoundingType::NORMAL);
+            assert(res.numWheatReceived == 0);
+        }
+    }
+    assert(cleared > 10);
+    store.checkLiabilities();
+}
+
+// SECTION("Level sweep crosses whole offers as the per offer loop does")
+void testLevelSweep() {
+    // A deep level taken a level at a time: the trades go out one per offer,
+    // the level update once, and the liabilities of the sellers follow.
+    BookRegistry registry;
+    AssetID native = registry.intern(makeNativeAsset());
+    AssetID usd = registry.intern(makeAsset("USD", 100));
+    AccountStore store(registry);
+    for (AccountID account = 1; account <= 3; ++account)
+    {
+        store.createAccount(account, 1000000000);
+        store.createTrustLine(account, usd, INT64_MAX, AUTHORIZED_FLAG);
+    }
+    store.setCheckLiabilities(true);
+    registry.setAccountStore(&store);
+    OrderBook& deep = registry.book(usd, native);
+    MarketDataFeed feed(4096);
+    deep.setMarketDataFeed(&feed);
+    for (int64_t id = 1; id <= 1000; ++id)
+    {
+        deep.addOffer(Offer{(AccountID)(id % 3 + 1), id, 100, Price{1, 1}});
+    }
+    deep.addOffer(Offer{1, 1001, 100, Price{2, 1}});
+    uint64_t seq = feed.nextSequence();
+
+    int64_t sheepSend, wheatReceived;
+    std::vector<ClaimAtom> trail;
+    auto res = convertWithOffers(deep, 50050, sheepSend, INT64_MAX,
+                                 wheatReceived, RoundingType::NORMAL, nullptr,
+                                 trail, INT64_MAX);
+    assert(res == ConvertResult::eOK);
+    assert(sheepSend == 50050 && wheatReceived == 50050);
+    assert(trail.size() == 501);
+    assert(trail[499].offerID == 500 && trail[499].amountSold == 100);
+    assert(trail[500].offerID == 501 && trail[500].amountSold == 50);
+    Offer best;
+    assert(deep.loadBestOffer(best) && best.offerID == 501 &&
+           best.amount == 50);
+    assert(deep.size() == 501);
+    int64_t trades = 0;
+    int64_t modifies = 0;
+    MarketDataEvent event;
+    for (; feed.read(seq, event) == MarketDataFeed::ReadResult::eOK; ++seq)
+    {
+        trades += event.type == MarketDataEventType::TRADE;
+        modifies += event.type == MarketDataEventType::LEVEL_MODIFY;
+    }
+    assert(trades == 501 && modifies == 2);
+    assert(store.findTrustLine(2, usd)->sellingLiabilities == 167 * 100);
+    store.checkLiabilities();
+
+    // Random books with deep levels, some offers not adjusted, crossed with
+    // every rounding, filters and limits on the number of offers, against
+    // copies that quote offer by offer and commit the quotes.
+    Rng next{77};
+    Price const prices[] = {Price{1, 1},  Price{3, 7},      Price{7, 3},
+                            Price{99, 100}, Price{101, 100}, Price{1, 1000},
+                            Price{1000, 1}};
+    int64_t id = 0;
+    for (int round = 0; round < 200; ++round)
+    {
+        OrderBook book;
+        int levels = (int)(next() % 4 + 1);
+        for (int level = 0; level < levels; ++level)
+        {
+            Price price = prices[next() % 7];
+            int offers = (int)(next() % 200);
+            for (int i = 0; i < offers; ++i)
+            {
+                // Some left as placed; crossing an offer with nothing
+                // that can trade at its price would throw either way.
+                int64_t amount = next() % 3000 + 1;
+                int64_t adjusted = adjustOffer(price, amount, INT64_MAX);
+                if (adjusted == 0)
+                {
+                    continue;
+                }
+                book.addOffer(Offer{(AccountID)(next() % 3 + 1), ++id,
+                                    next() % 4 == 0 ? amount : adjusted,
+                                    price});
+            }
+        }
+
+        OrderBook quoted = book;
+        for (int order = 0; order < 4; ++order)
+        {
+            RoundingType rt = (RoundingType)(next() % 3);
+            int64_t maxSend = next() % 2 ? next() % 400000 + 1 : INT64_MAX;
+            int64_t maxReceive =
+                maxSend == INT64_MAX || next() % 2 ? next() % 400000 + 1
+                                                   : INT64_MAX;
+            if (rt == RoundingType::PATH_PAYMENT_STRICT_SEND)
+            {
+                maxSend = next() % 400000 + 1;
+                maxReceive = INT64_MAX;
+            }
+            int64_t maxCross = next() % 2 ? next() % 300 + 1 : INT64_MAX;
+            AccountID taker = (AccountID)(next() % 4 + 1);
+            Price limit = prices[next() % 7];
+            bool filtered = next() % 2;
+            auto filter =
+                filtered ? makeOfferFilter(book, taker, limit, false) : nullptr;
+            auto quotedFilter =
+                filtered ? makeOfferFilter(quoted, taker, limit, false)
+                         : nullptr;
+
+            trail.clear();
+            res = convertWithOffers(book, maxSend, sheepSend, maxReceive,
+                                    wheatReceived, rt, filter, trail,
+                                    maxCross);
+            std::vector<ClaimAtom> quotedTrail;
+            BookPosition position;
+            int64_t quotedSheep, quotedWheat, lastAmount;
+            auto quotedRes = quoteWithOffers(
+                quoted, position, maxSend, quotedSheep, maxReceive,
+                quotedWheat, rt, quotedFilter, quotedTrail, maxCross,
+                lastAmount);
+            commitQuote(quoted, quotedTrail, 0, quotedTrail.size(),
+                        lastAmount);
+
+            assert(res == quotedRes);
+            assert(sheepSend == quotedSheep && wheatReceived == quotedWheat);
+            assert(trail.size() == quotedTrail.size());
+            for (size_t i = 0; i < trail.size(); ++i)
+            {
+                assert(trail[i].sellerID == quotedTrail[i].sellerID &&
+                       trail[i].offerID == quotedTrail[i].offerID &&
+                       trail[i].amountSold == quotedTrail[i].amountSold &&
+                       trail[i].amountBought == quotedTrail[i].amountBought);
+            }
+            std::vector<Offer> left, quotedLeft;
+            book.forEachOffer([&](Offer const& o) { left.push_back(o); });
+            quoted.forEachOffer(
+                [&](Offer const& o) { quotedLeft.push_back(o); });
+            assert(left.size() == quotedLeft.size());
+            for (size_t i = 0; i < left.size(); ++i)
+            {
+                assert(left[i].offerID == quotedLeft[i].offerID &&
+                       left[i].amount == quotedLeft[i].amount);
+            }
+            std::vector<DepthLevel> depth, quotedDepth;
+            book.getDepth(depth, SIZE_MAX);
+            quoted.getDepth(quotedDepth, SIZE_MAX);
+            assert(depth.size() == quotedDepth.size());
+            for (size_t i = 0; i < depth.size(); ++i)
+            {
+                assert(depth[i].amount == quotedDepth[i].amount &&
+                       depth[i].numOffers == quotedDepth[i].numOffers);
+            }
+        }
+    }
+}